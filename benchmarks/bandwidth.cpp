@@ -0,0 +1,117 @@
+#include "benchmark.hpp"
+
+// Measures bandwidth of large messages from a client to the server over loopback, sent either
+// from the message body or as a file payload the kernel copies with sendfile.
+//
+// usage: bandwidth [megabytes per run]
+
+enum class BenchmarkMessages : uint32_t
+{
+  Data,
+};
+
+class CountingServer : public netron::server_interface<BenchmarkMessages>
+{
+public:
+  CountingServer(uint16_t port, netron::config cfg)
+    : netron::server_interface<BenchmarkMessages>(port, cfg)
+  {}
+
+  std::atomic<uint64_t> received{ 0 };
+
+protected:
+  virtual void on_message(Client client, Message& msg)
+  {
+    received++;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  const uint32_t megabytes = argc > 1 ? std::stoul(argv[1]) : 512;
+  const uint32_t sizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 8 * 1024 * 1024 };
+
+#ifdef NETRON_HAS_FILE_PAYLOAD
+  const char* sources[] = { "body", "file" };
+#else
+  const char* sources[] = { "body" };
+#endif
+  const size_t source_count = sizeof(sources) / sizeof(sources[0]);
+  const std::string file_path = "netron-bandwidth.bin";
+
+  benchmark::report report("bandwidth");
+  report.parameters().set("megabytes", megabytes);
+
+  for (size_t run = 0; run < source_count * sizeof(sizes) / sizeof(sizes[0]); ++run)
+  {
+    const size_t s = run / source_count;
+    const bool is_file = std::string(sources[run % source_count]) == "file";
+    const uint16_t port = uint16_t(63100 + run);
+    const uint32_t messages = std::max<uint32_t>(1, uint32_t(uint64_t(megabytes) * 1024 * 1024 / sizes[s]));
+
+    netron::config cfg;
+    cfg.max_message_size = std::max<netron::byte_size>(cfg.max_message_size, sizes[s]);
+    CountingServer server(port, cfg);
+    server.start();
+
+    // Messages are handed to on_message on a thread of its own as they arrive
+    asio::io_context dispatch_context;
+    auto work_guard = asio::make_work_guard(dispatch_context);
+    std::thread dispatch_thread([&dispatch_context]() { dispatch_context.run(); });
+    server.dispatch_messages(dispatch_context.get_executor());
+
+    netron::client_interface<BenchmarkMessages> client;
+    client.connect("127.0.0.1", port, cfg);
+
+    netron::message<BenchmarkMessages> msg;
+    msg.header.id = BenchmarkMessages::Data;
+    msg.body.resize(is_file ? 0 : sizes[s]);
+    msg.header.size = uint32_t(msg.size());
+
+    netron::payload data;
+#ifdef NETRON_HAS_FILE_PAYLOAD
+    if (is_file)
+    {
+      std::ofstream(file_path, std::ios::binary).write(std::vector<char>(sizes[s]).data(), sizes[s]);
+      data = netron::payload::from_file(file_path);
+    }
+#endif
+
+    // Keep a bounded number of messages in flight, the send queue would otherwise hold all of them
+    const uint64_t window = std::max<uint64_t>(4, 64 * 1024 * 1024 / sizes[s]);
+    const auto start = std::chrono::steady_clock::now();
+    bool is_complete = true;
+    for (uint32_t i = 0; i < messages; ++i)
+    {
+      if (i >= window && !benchmark::wait_for_count(server.received, i - window + 1))
+      {
+        is_complete = false;
+        break;
+      }
+      if (is_file)
+        client.send_payload(msg, data);
+      else
+        client.send(msg);
+    }
+
+    is_complete = is_complete && benchmark::wait_for_count(server.received, messages);
+    const double elapsed = benchmark::seconds_since(start);
+
+    client.disconnect();
+    server.stop_dispatching_messages();
+    work_guard.reset();
+    dispatch_thread.join();
+
+    report.add_result()
+      .set("source", sources[run % source_count])
+      .set("message_bytes", sizes[s])
+      .set("messages", messages)
+      .set("complete", is_complete)
+      .set("seconds", elapsed)
+      .set("megabytes_per_second", double(messages) * sizes[s] / elapsed / 1e6);
+  }
+
+  std::remove(file_path.c_str());
+  report.print();
+  return 0;
+}
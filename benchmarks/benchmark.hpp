@@ -0,0 +1,193 @@
+#pragma once
+#include <netron.hpp>
+
+// Shared helpers of the benchmarks. Every benchmark prints one JSON document to stdout:
+//
+// { "benchmark": "<name>", "timestamp": <unix seconds>, "hardware_concurrency": <n>,
+//   "io_backend": "<epoll, io_uring, ...>", "parameters": { ... }, "results": [ { ... }, ... ] }
+
+namespace benchmark
+{
+
+  // Latency distribution of a set of samples in microseconds
+  struct summary
+  {
+    size_t count = 0;
+    double mean = 0.0, p50 = 0.0, p90 = 0.0, p99 = 0.0, p999 = 0.0, max = 0.0;
+
+    static summary of(std::vector<double> samples)
+    {
+      summary s;
+      if (samples.empty())
+        return s;
+
+      std::sort(samples.begin(), samples.end());
+      double sum = 0.0;
+      for (auto sample : samples)
+        sum += sample;
+
+      auto at = [&samples](double fraction) { return samples[std::min(samples.size() - 1, size_t(fraction * samples.size()))]; };
+      s.count = samples.size();
+      s.mean = sum / samples.size();
+      s.p50 = at(0.5);
+      s.p90 = at(0.9);
+      s.p99 = at(0.99);
+      s.p999 = at(0.999);
+      s.max = samples.back();
+      return s;
+    }
+  };
+
+  // A flat JSON object, values are kept in insertion order
+  class json_object
+  {
+  public:
+    json_object& set(const std::string& key, const std::string& value)
+    {
+      std::string quoted = "\"";
+      for (char c : value)
+      {
+        if (c == '"' || c == '\\')
+          quoted += '\\';
+        quoted += c;
+      }
+      m_fields.emplace_back(key, quoted + "\"");
+      return *this;
+    }
+
+    json_object& set(const std::string& key, const char* value)
+    {
+      return set(key, std::string(value));
+    }
+
+    json_object& set(const std::string& key, bool value)
+    {
+      m_fields.emplace_back(key, value ? "true" : "false");
+      return *this;
+    }
+
+    json_object& set(const std::string& key, double value)
+    {
+      std::ostringstream os;
+      os.precision(10);
+      os << value;
+      m_fields.emplace_back(key, os.str());
+      return *this;
+    }
+
+    json_object& set(const std::string& key, uint64_t value)
+    {
+      m_fields.emplace_back(key, std::to_string(value));
+      return *this;
+    }
+
+    json_object& set(const std::string& key, uint32_t value)
+    {
+      return set(key, uint64_t(value));
+    }
+
+    // Adds <key>_mean_us, <key>_p50_us, ... for a latency summary
+    json_object& set(const std::string& key, const summary& s)
+    {
+      set(key + "_count", uint64_t(s.count));
+      set(key + "_mean_us", s.mean);
+      set(key + "_p50_us", s.p50);
+      set(key + "_p90_us", s.p90);
+      set(key + "_p99_us", s.p99);
+      set(key + "_p999_us", s.p999);
+      set(key + "_max_us", s.max);
+      return *this;
+    }
+
+    void print(std::ostream& os) const
+    {
+      os << "{ ";
+      for (size_t i = 0; i < m_fields.size(); ++i)
+        os << (i ? ", " : "") << '"' << m_fields[i].first << "\": " << m_fields[i].second;
+      os << " }";
+    }
+
+  private:
+    std::vector<std::pair<std::string, std::string>> m_fields;
+  };
+
+  class report
+  {
+  public:
+    report(const std::string& name)
+      : m_name(name)
+    {
+      // The library reports every connection, keep it quiet while measuring
+      netron::logger::set_level(netron::log_level::off);
+    }
+
+    json_object& parameters()
+    {
+      return m_parameters;
+    }
+
+    json_object& add_result()
+    {
+      m_results.emplace_back();
+      return m_results.back();
+    }
+
+    void print(std::ostream& os = std::cout) const
+    {
+      const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+      os << "{\n";
+      os << "  \"benchmark\": \"" << m_name << "\",\n";
+      os << "  \"timestamp\": " << timestamp << ",\n";
+      os << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+      os << "  \"io_backend\": \"" << netron::io_backend() << "\",\n";
+      os << "  \"parameters\": ";
+      m_parameters.print(os);
+      os << ",\n  \"results\": [";
+      for (size_t i = 0; i < m_results.size(); ++i)
+      {
+        os << (i ? ",\n    " : "\n    ");
+        m_results[i].print(os);
+      }
+      os << "\n  ]\n}\n";
+    }
+
+  private:
+    std::string m_name;
+    json_object m_parameters;
+    std::deque<json_object> m_results;
+  };
+
+  inline double seconds_since(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // Polls the queue until it holds count items or the timeout passes, returns false on timeout
+  template<typename Queue>
+  bool wait_for_count(Queue& queue, size_t count, std::chrono::seconds timeout = std::chrono::seconds(60))
+  {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (queue.count() < count)
+    {
+      if (std::chrono::steady_clock::now() > deadline)
+        return false;
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  // Polls the counter until it reaches count or the timeout passes, returns false on timeout
+  inline bool wait_for_count(std::atomic<uint64_t>& counter, uint64_t count, std::chrono::seconds timeout = std::chrono::seconds(60))
+  {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (counter < count)
+    {
+      if (std::chrono::steady_clock::now() > deadline)
+        return false;
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,93 @@
+#include "benchmark.hpp"
+
+// Measures how many connections per second the server accepts and starts the handshake for,
+// for an increasing number of SO_REUSEPORT acceptors.
+//
+// usage: connection_rate [max acceptors] [client threads] [seconds per run]
+
+enum class BenchmarkMessages : uint32_t
+{
+  None,
+};
+
+using BenchmarkServer = netron::server_interface<BenchmarkMessages>;
+
+// Connects, waits for the server's handshake and resets the connection, as fast as possible
+uint64_t connect_loop(uint16_t port, std::chrono::steady_clock::time_point deadline)
+{
+  asio::io_context context;
+  const asio::ip::tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), port);
+
+  uint64_t connections = 0;
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    asio::error_code ec;
+    asio::ip::tcp::socket socket(context);
+    socket.connect(endpoint, ec);
+    if (ec)
+      continue;
+
+    uint64_t handshake = 0;
+    asio::read(socket, asio::buffer(&handshake, sizeof(handshake)), ec);
+    if (!ec)
+      connections++;
+
+    // Reset instead of a regular close so the client ports do not pile up in TIME_WAIT
+    socket.set_option(asio::socket_base::linger(true, 0), ec);
+    socket.close(ec);
+  }
+  return connections;
+}
+
+int main(int argc, char** argv)
+{
+  const uint32_t hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+  const uint32_t max_acceptors = argc > 1 ? std::stoul(argv[1]) : hardware_threads;
+  const uint32_t client_threads = argc > 2 ? std::stoul(argv[2]) : hardware_threads;
+  const uint32_t seconds = argc > 3 ? std::stoul(argv[3]) : 3;
+
+  benchmark::report report("connection_rate");
+  report.parameters()
+    .set("max_acceptors", max_acceptors)
+    .set("client_threads", client_threads)
+    .set("seconds", seconds);
+
+  for (uint32_t acceptors = 1; acceptors <= max_acceptors; acceptors *= 2)
+  {
+    const uint16_t port = uint16_t(61000 + acceptors);
+
+    netron::config cfg;
+    cfg.acceptor_count = acceptors;
+    cfg.max_pending_connections = std::numeric_limits<uint32_t>::max();
+
+    double elapsed = 0.0;
+    std::vector<uint64_t> counts(client_threads, 0);
+    {
+      BenchmarkServer server(port, cfg);
+      server.start();
+
+      const auto start = std::chrono::steady_clock::now();
+      const auto deadline = start + std::chrono::seconds(seconds);
+
+      std::vector<std::thread> clients;
+      for (uint32_t i = 0; i < client_threads; ++i)
+        clients.emplace_back([&counts, i, port, deadline]() { counts[i] = connect_loop(port, deadline); });
+      for (auto& client : clients)
+        client.join();
+
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint64_t total = 0;
+    for (auto count : counts)
+      total += count;
+    report.add_result()
+      .set("acceptors", acceptors)
+      .set("connections", total)
+      .set("connections_per_second", total / elapsed);
+  }
+
+  report.print();
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include "benchmark.hpp"
+
+// Measures how fast the server broadcasts to many clients with message_all_clients, the clients
+// share the I/O threads of a client_pool.
+//
+// usage: fanout [broadcasts per run] [max clients] [payload bytes]
+
+enum class BenchmarkMessages : uint32_t
+{
+  Broadcast,
+};
+
+class BroadcastServer : public netron::server_interface<BenchmarkMessages>
+{
+public:
+  BroadcastServer(uint16_t port)
+    : netron::server_interface<BenchmarkMessages>(port)
+  {}
+
+  std::atomic<uint32_t> ready{ 0 };
+
+  virtual void on_client_ready(Client client)
+  {
+    ready++;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  const uint32_t broadcasts = argc > 1 ? std::stoul(argv[1]) : 1000;
+  const uint32_t max_clients = argc > 2 ? std::stoul(argv[2]) : 100;
+  const uint32_t payload = argc > 3 ? std::stoul(argv[3]) : 64;
+
+  benchmark::report report("fanout");
+  report.parameters()
+    .set("broadcasts", broadcasts)
+    .set("max_clients", max_clients)
+    .set("payload_bytes", payload);
+
+  for (uint32_t clients = 1; clients <= max_clients; clients *= 10)
+  {
+    const uint16_t port = uint16_t(63200 + clients % 1000);
+
+    BroadcastServer server(port);
+    server.start();
+
+    netron::client_pool<BenchmarkMessages> pool;
+    pool.connect("127.0.0.1", port, clients);
+    while (server.ready < clients || pool.count() < clients)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    netron::message<BenchmarkMessages> msg;
+    msg.header.id = BenchmarkMessages::Broadcast;
+    msg.body.resize(payload);
+    msg.header.size = uint32_t(msg.size());
+
+    const uint64_t deliveries = uint64_t(broadcasts) * clients;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < broadcasts; ++i)
+      server.message_all_clients(msg);
+
+    const bool is_complete = benchmark::wait_for_count(pool.incoming(), deliveries);
+    const double elapsed = benchmark::seconds_since(start);
+
+    pool.stop();
+
+    report.add_result()
+      .set("clients", clients)
+      .set("complete", is_complete)
+      .set("seconds", elapsed)
+      .set("broadcasts_per_second", broadcasts / elapsed)
+      .set("deliveries_per_second", pool.incoming().count() / elapsed);
+  }
+
+  report.print();
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include "benchmark.hpp"
+
+// Measures request/response round trip latency over loopback for different socket options.
+//
+// usage: latency [round trips per run] [payload bytes]
+
+enum class BenchmarkMessages : uint32_t
+{
+  Welcome,
+  Ping,
+};
+
+class EchoServer : public netron::server_interface<BenchmarkMessages>
+{
+public:
+  EchoServer(uint16_t port, netron::config cfg)
+    : netron::server_interface<BenchmarkMessages>(port, cfg)
+  {}
+
+protected:
+  virtual void on_client_ready(Client client)
+  {
+    Message msg;
+    msg.header.id = BenchmarkMessages::Welcome;
+    client->send(msg);
+  }
+
+  virtual void on_message(Client client, Message& msg)
+  {
+    client->send(msg);
+  }
+};
+
+class PingClient : public netron::client_interface<BenchmarkMessages>
+{
+public:
+  Message receive()
+  {
+    while (incoming().empty())
+      std::this_thread::yield();
+    return incoming().pop_front().msg;
+  }
+};
+
+struct variant
+{
+  const char* name;
+  netron::config cfg;
+};
+
+int main(int argc, char** argv)
+{
+  const uint32_t round_trips = argc > 1 ? std::stoul(argv[1]) : 2000;
+  const uint32_t payload = argc > 2 ? std::stoul(argv[2]) : 64;
+
+  std::vector<variant> variants(6);
+  variants[0].name = "nagle";
+  variants[0].cfg.tcp_no_delay = false;
+  variants[1].name = "no_delay";
+  variants[2].name = "nagle+quick_ack";
+  variants[2].cfg.tcp_no_delay = false;
+  variants[2].cfg.tcp_quick_ack = true;
+  variants[3].name = "no_delay+quick_ack";
+  variants[3].cfg.tcp_quick_ack = true;
+  variants[4].name = "no_delay+4KB_buffers";
+  variants[4].cfg.send_buffer_size = 4096;
+  variants[4].cfg.receive_buffer_size = 4096;
+  variants[5].name = "no_delay+keep_alive";
+  variants[5].cfg.keep_alive = true;
+
+  benchmark::report report("latency");
+  report.parameters()
+    .set("round_trips", round_trips)
+    .set("payload_bytes", payload);
+
+  for (size_t v = 0; v < variants.size(); ++v)
+  {
+    const uint16_t port = uint16_t(62000 + v);
+    std::vector<double> samples;
+    samples.reserve(round_trips);
+
+    {
+      EchoServer server(port, variants[v].cfg);
+      server.start();
+
+      std::atomic<bool> running{ true };
+      std::thread server_thread(
+        [&server, &running]()
+        {
+          while (running)
+          {
+            server.update(std::numeric_limits<size_t>::max(), false);
+            std::this_thread::yield();
+          }
+        }
+      );
+
+      PingClient client;
+      client.connect("127.0.0.1", port, variants[v].cfg);
+      client.receive(); // Welcome
+
+      PingClient::Message ping;
+      ping.header.id = BenchmarkMessages::Ping;
+      ping.body.resize(payload);
+      ping.header.size = uint32_t(ping.size());
+
+      for (uint32_t i = 0; i < round_trips; ++i)
+      {
+        const auto start = std::chrono::steady_clock::now();
+        client.send(ping);
+        client.receive();
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+      }
+
+      client.disconnect();
+      running = false;
+      server_thread.join();
+    }
+
+    report.add_result()
+      .set("variant", variants[v].name)
+      .set("round_trip", benchmark::summary::of(samples));
+  }
+
+  report.print();
+
+  return 0;
+}
@@ -0,0 +1,14 @@
+# Runs one benchmark and stores its JSON report, used by the run-benchmarks target:
+#   cmake -DBENCHMARK=<executable> -DOUTPUT=<file.json> -P run_benchmark.cmake
+
+execute_process(
+  COMMAND ${BENCHMARK}
+  OUTPUT_FILE ${OUTPUT}
+  RESULT_VARIABLE result
+)
+
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${BENCHMARK} failed: ${result}")
+endif()
+
+message(STATUS "Wrote ${OUTPUT}")
@@ -0,0 +1,89 @@
+#include "benchmark.hpp"
+
+// Measures pushing data into and popping it from message.hpp's message buffer, without any I/O.
+//
+// usage: serialization [iterations per case]
+
+enum class BenchmarkMessages : uint32_t
+{
+  Data,
+};
+
+using Message = netron::message<BenchmarkMessages>;
+
+struct Point
+{
+  float x, y, z;
+};
+
+// Defeats dead code elimination of the popped values
+static volatile uint64_t sink;
+
+template<typename Push, typename Pop>
+void run(benchmark::report& report, const char* name, uint32_t iterations, Push push, Pop pop)
+{
+  Message msg;
+  msg.body.reserve(1 << 16);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    push(msg);
+    pop(msg);
+  }
+  const double elapsed = benchmark::seconds_since(start);
+
+  // Push only, the body keeps growing like a message being built
+  msg.body.clear();
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    if (msg.body.size() > (1 << 20))
+      msg.body.clear();
+    push(msg);
+  }
+  const double push_elapsed = benchmark::seconds_since(start);
+
+  report.add_result()
+    .set("case", name)
+    .set("round_trip_ns", elapsed / iterations * 1e9)
+    .set("push_ns", push_elapsed / iterations * 1e9);
+}
+
+int main(int argc, char** argv)
+{
+  const uint32_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+  benchmark::report report("serialization");
+  report.parameters().set("iterations", iterations);
+
+  run(report, "uint32", iterations,
+    [](Message& msg) { msg << uint32_t(42); },
+    [](Message& msg) { uint32_t v; msg >> v; sink = v; });
+
+  run(report, "struct_12_bytes", iterations,
+    [](Message& msg) { msg << Point{ 1.0f, 2.0f, 3.0f }; },
+    [](Message& msg) { Point p; msg >> p; sink = uint64_t(p.x); });
+
+  run(report, "mixed_scalars", iterations,
+    [](Message& msg) { msg << uint8_t(1) << uint16_t(2) << uint32_t(3) << uint64_t(4) << 5.0; },
+    [](Message& msg) { uint8_t a; uint16_t b; uint32_t c; uint64_t d; double e; msg >> e >> d >> c >> b >> a; sink = a + b + c + d; });
+
+  const std::string text(64, 'x');
+  run(report, "string_64", iterations / 10,
+    [&text](Message& msg) { msg << text; },
+    [](Message& msg) { std::string s; msg >> s; sink = s.size(); });
+
+  const std::vector<uint32_t> numbers(1024, 7);
+  run(report, "vector_uint32_1024", iterations / 100,
+    [&numbers](Message& msg) { msg << numbers; },
+    [](Message& msg) { std::vector<uint32_t> v; msg >> v; sink = v.size(); });
+
+  const std::vector<std::string> words(64, std::string(16, 'y'));
+  run(report, "vector_string_64", iterations / 100,
+    [&words](Message& msg) { msg << words; },
+    [](Message& msg) { std::vector<std::string> v; msg >> v; sink = v.size(); });
+
+  report.print();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "benchmark.hpp"
+
+// Measures one-way throughput of small messages from a client to the server over loopback.
+//
+// usage: throughput [messages per run] [coalesce window in microseconds]
+
+enum class BenchmarkMessages : uint32_t
+{
+  Data,
+};
+
+class CountingServer : public netron::server_interface<BenchmarkMessages>
+{
+public:
+  CountingServer(uint16_t port)
+    : netron::server_interface<BenchmarkMessages>(port)
+  {}
+
+  std::atomic<uint64_t> received{ 0 };
+
+protected:
+  virtual void on_message(Client client, Message& msg)
+  {
+    received++;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  const uint32_t messages = argc > 1 ? std::stoul(argv[1]) : 200000;
+  const uint32_t payloads[] = { 0, 16, 64, 256, 1024 };
+
+  netron::config cfg;
+  cfg.coalesce_window = argc > 2 ? std::stoul(argv[2]) : 0;
+
+  benchmark::report report("throughput");
+  report.parameters()
+    .set("messages", messages)
+    .set("coalesce_window", cfg.coalesce_window);
+
+  for (size_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); ++p)
+  {
+    const uint16_t port = uint16_t(63000 + p);
+
+    CountingServer server(port);
+    server.start();
+
+    // Messages are handed to on_message on a thread of its own as they arrive
+    asio::io_context dispatch_context;
+    auto work_guard = asio::make_work_guard(dispatch_context);
+    std::thread dispatch_thread([&dispatch_context]() { dispatch_context.run(); });
+    server.dispatch_messages(dispatch_context.get_executor());
+
+    netron::client_interface<BenchmarkMessages> client;
+    client.connect("127.0.0.1", port, cfg);
+
+    netron::message<BenchmarkMessages> msg;
+    msg.header.id = BenchmarkMessages::Data;
+    msg.body.resize(payloads[p]);
+    msg.header.size = uint32_t(msg.size());
+
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < messages; ++i)
+      client.send(msg);
+    client.flush();
+
+    const bool is_complete = benchmark::wait_for_count(server.received, messages);
+    const double elapsed = benchmark::seconds_since(start);
+
+    client.disconnect();
+    server.stop_dispatching_messages();
+    work_guard.reset();
+    dispatch_thread.join();
+
+    const double bytes = double(messages) * (sizeof(netron::wire_header<BenchmarkMessages>) + payloads[p]);
+    report.add_result()
+      .set("payload_bytes", payloads[p])
+      .set("complete", is_complete)
+      .set("seconds", elapsed)
+      .set("messages_per_second", messages / elapsed)
+      .set("megabytes_per_second", bytes / elapsed / 1e6);
+  }
+
+  report.print();
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include "benchmark.hpp"
+
+// Compares the transports a client can reach a server on the same host with: TCP over loopback,
+// a Unix domain socket, shared-memory rings set up over a Unix domain socket and the in-process
+// transport, which skips the kernel and serialization entirely. The differences are the costs the
+// operating system adds to the library's own.
+//
+// usage: transports [round trips per run] [messages per run] [payload bytes]
+
+enum class BenchmarkMessages : uint32_t
+{
+  Ping,
+  Data,
+};
+
+class EchoServer : public netron::server_interface<BenchmarkMessages>
+{
+public:
+  EchoServer(uint16_t port)
+    : netron::server_interface<BenchmarkMessages>(port)
+  {}
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+  EchoServer(const std::string& path, netron::config cfg)
+    : netron::server_interface<BenchmarkMessages>(asio::local::stream_protocol::endpoint(path), cfg)
+  {}
+#endif
+
+  std::atomic<uint64_t> received{ 0 };
+
+protected:
+  virtual void on_message(Client client, Message& msg)
+  {
+    if (msg.header.id == BenchmarkMessages::Ping)
+      client->send(msg);
+    else
+      received++;
+  }
+};
+
+enum class transport
+{
+  tcp,
+  local,
+  shared_memory,
+  in_process,
+};
+
+int main(int argc, char** argv)
+{
+  const uint32_t round_trips = argc > 1 ? std::stoul(argv[1]) : 20000;
+  const uint32_t messages = argc > 2 ? std::stoul(argv[2]) : 200000;
+  const uint32_t payload = argc > 3 ? std::stoul(argv[3]) : 64;
+
+  const struct { const char* name; transport type; } transports[] = {
+    { "tcp", transport::tcp },
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    { "unix", transport::local },
+#endif
+#ifdef NETRON_HAS_SHARED_MEMORY
+    { "shared_memory", transport::shared_memory },
+#endif
+    { "in_process", transport::in_process },
+  };
+
+  benchmark::report report("transports");
+  report.parameters()
+    .set("round_trips", round_trips)
+    .set("messages", messages)
+    .set("payload_bytes", payload);
+
+  for (size_t t = 0; t < sizeof(transports) / sizeof(transports[0]); ++t)
+  {
+    const uint16_t port = uint16_t(63300 + t);
+    const std::string path = "netron-transports-" + std::to_string(port) + ".sock";
+
+    netron::config cfg;
+    cfg.shared_memory = transports[t].type == transport::shared_memory;
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    std::unique_ptr<EchoServer> server_owner = transports[t].type == transport::local || transports[t].type == transport::shared_memory
+      ? std::make_unique<EchoServer>(path, cfg)
+      : std::make_unique<EchoServer>(port);
+#else
+    std::unique_ptr<EchoServer> server_owner = std::make_unique<EchoServer>(port);
+#endif
+    EchoServer& server = *server_owner;
+    server.start();
+
+    asio::io_context dispatch_context;
+    auto work_guard = asio::make_work_guard(dispatch_context);
+    std::thread dispatch_thread([&dispatch_context]() { dispatch_context.run(); });
+    server.dispatch_messages(dispatch_context.get_executor());
+
+    netron::client_interface<BenchmarkMessages> client;
+    bool connected = false;
+    switch (transports[t].type)
+    {
+    case transport::tcp:
+      connected = client.connect("127.0.0.1", port);
+      break;
+    case transport::local:
+    case transport::shared_memory:
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+      connected = client.connect_local(path, cfg);
+#endif
+      break;
+    case transport::in_process:
+      connected = client.connect_in_process(server);
+      break;
+    }
+
+    std::vector<double> samples;
+    double elapsed = 0.0;
+    if (connected)
+    {
+      // Round trips, the client polls its queue so only the transport is measured
+      netron::message<BenchmarkMessages> ping;
+      ping.header.id = BenchmarkMessages::Ping;
+      ping.body.resize(payload);
+      ping.header.size = uint32_t(ping.size());
+
+      samples.reserve(round_trips);
+      for (uint32_t i = 0; i < round_trips; ++i)
+      {
+        const auto sent = std::chrono::steady_clock::now();
+        client.send(ping);
+        while (client.incoming().empty())
+          std::this_thread::yield();
+        client.incoming().pop_front();
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+      }
+
+      // One-way throughput
+      netron::message<BenchmarkMessages> data;
+      data.header.id = BenchmarkMessages::Data;
+      data.body.resize(payload);
+      data.header.size = uint32_t(data.size());
+
+      const auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < messages; ++i)
+        client.send(data);
+      while (server.received < messages)
+        std::this_thread::yield();
+      elapsed = benchmark::seconds_since(start);
+    }
+
+    client.disconnect();
+    server.stop_dispatching_messages();
+    work_guard.reset();
+    dispatch_thread.join();
+
+    report.add_result()
+      .set("transport", transports[t].name)
+      .set("connected", connected)
+      .set("round_trip", benchmark::summary::of(samples))
+      .set("messages_per_second", elapsed > 0.0 ? messages / elapsed : 0.0);
+  }
+
+  report.print();
+  return 0;
+}
@@ -15,7 +15,22 @@ public:
     std::chrono::system_clock::time_point time_now = std::chrono::system_clock::now();
     msg << time_now;
     
-    send(msg);
+    // The server bounces the message back, the reply is matched to this call
+    call(msg,
+      [](std::error_code ec, Message& reply)
+      {
+        if (ec)
+        {
+          std::cout << "Ping Fail: " << ec.message() << "\n";
+          return;
+        }
+
+        std::chrono::system_clock::time_point time_now = std::chrono::system_clock::now();
+        std::chrono::system_clock::time_point time_then;
+        reply >> time_then;
+        std::cout << "Ping: " << std::chrono::duration<double>(time_now - time_then).count() << "s\n";
+      }
+    );
   }
 
   void MessageAll()
@@ -34,12 +49,26 @@ public:
     msg << std::list<std::vector<Point>>{ { Point(1, 2), Point(3, 4) }, { Point(5, 6), Point(7, 8) } };
     send(msg);
   }
+
+protected:
+  virtual void on_connect()
+  {
+    std::cout << "Connected\n";
+  }
+
+  virtual void on_disconnect()
+  {
+    std::cout << "Server Down, reconnecting...\n";
+  }
 };
 
 int main(void)
 {
+  netron::config cfg;
+  cfg.reconnect = true;
+
   CustomClient client;
-  client.connect("127.0.0.1", 60000);
+  client.connect("127.0.0.1", 60000, cfg);
 
 #ifdef OS_WINDOWS
   bool key[4] = { false, false, false, false };
@@ -90,44 +119,28 @@ int main(void)
       old_key[i] = key[i];
 #endif
 
-    if (client.is_connected())
+    if (!client.incoming().empty())
     {
-      if (!client.incoming().empty())
-      {
-        auto msg = client.incoming().pop_front().msg;
-
-        switch (msg.header.id)
-        {
-        case CustomMessageTypes::ServerAccept:
-        {
-          std::cout << "Server Accepted Connection\n";
-        }
-        break;
+      auto msg = client.incoming().pop_front().msg;
 
-        case CustomMessageTypes::ServerPing:
-        {
-          std::chrono::system_clock::time_point time_now = std::chrono::system_clock::now();
-          std::chrono::system_clock::time_point time_then;
-          msg >> time_then;
-          std::cout << "Ping: " << std::chrono::duration<double>(time_now - time_then).count() << "s\n";
-        }
-        break;
+      switch (msg.header.id)
+      {
+      case CustomMessageTypes::ServerAccept:
+      {
+        std::cout << "Server Accepted Connection\n";
+      }
+      break;
 
-        case CustomMessageTypes::ServerMessage:
-        {
-          uint32_t clientID;
-          msg >> clientID;
-          std::cout << "Hello from [" << clientID << "]\n";
-        }
-        break;
-        }
+      case CustomMessageTypes::ServerMessage:
+      {
+        uint32_t clientID;
+        msg >> clientID;
+        std::cout << "Hello from [" << clientID << "]\n";
+      }
+      break;
       }
     }
-    else
-    {
-      std::cout << "Server Down\n";
-      should_quit = true;
-    }
+
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
 
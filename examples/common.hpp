@@ -21,6 +21,20 @@ enum class CustomMessageTypes : uint32_t
   SendComplexData,
 };
 
+// Ids are checked on receive and sent in a single byte
+namespace netron
+{
+  template<>
+  struct message_id_traits<CustomMessageTypes> : message_ids<CustomMessageTypes,
+    CustomMessageTypes::ServerAccept,
+    CustomMessageTypes::ServerDeny,
+    CustomMessageTypes::ServerPing,
+    CustomMessageTypes::MessageAll,
+    CustomMessageTypes::ServerMessage,
+    CustomMessageTypes::SendComplexData>
+  {};
+}
+
 struct Point
 {
   int x, y;
@@ -28,7 +28,7 @@ protected:
     case CustomMessageTypes::ServerPing:
     {
       std::cout << "[" << client->get_id() << "]: Server Ping\n";
-      client->send(msg); // bounce message back to client
+      reply(client, msg, msg); // bounce message back to client as the reply to its call
     }
     break;
 
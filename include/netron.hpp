@@ -2,8 +2,19 @@
 
 #include <netron/common.hpp>
 #include <netron/asio.hpp>
+#include <netron/log.hpp>
 #include <netron/message.hpp>
+#include <netron/spool.hpp>
 #include <netron/tsqueue.hpp>
+#include <netron/mpsc_queue.hpp>
+#include <netron/token_bucket.hpp>
+#include <netron/metrics.hpp>
+#include <netron/transport.hpp>
+#include <netron/shared_memory.hpp>
+#include <netron/datagram.hpp>
+#include <netron/payload.hpp>
+#include <netron/crc32c.hpp>
 #include <netron/connection.hpp>
 #include <netron/client.hpp>
+#include <netron/client_pool.hpp>
 #include <netron/server.hpp>
\ No newline at end of file
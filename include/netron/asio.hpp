@@ -5,6 +5,18 @@
 #endif
 
 #define ASIO_STANDALONE
+
+// Linux builds run their sockets on io_uring instead of epoll when NETRON_IO_URING is defined,
+// liburing has to be linked
+#if defined(NETRON_IO_URING) && defined(__linux__)
+  #define ASIO_HAS_IO_URING 1
+  #define ASIO_DISABLE_EPOLL 1
+#endif
+
 #include <asio.hpp>
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
+
+#if defined(NETRON_IO_URING) && defined(__linux__) && ASIO_VERSION < 102100
+  #error "NETRON_IO_URING needs asio 1.21 or newer"
+#endif
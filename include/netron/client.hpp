@@ -2,11 +2,12 @@
 
 #include <netron/common.hpp>
 #include <netron/asio.hpp>
+#include <netron/log.hpp>
 #include <netron/tsqueue.hpp>
 #include <netron/message.hpp>
 #include <netron/connection.hpp>
 
-namespace netron 
+namespace netron
 {
 
   template<typename T>
@@ -14,85 +15,613 @@ namespace netron
   {
   public:
     using Message = message<T>;
+    using CallHandler = std::function<void(std::error_code, Message&)>;
 
     client_interface()
+      : m_reconnect_timer(m_asio_context), m_random(std::random_device{}())
     {}
 
     virtual ~client_interface()
     {
+      m_messages_in.set_notifier(nullptr);
       disconnect();
     }
   public:
 
-    // Connect to server with hostname/ip-address and port
+    // Connect to server with hostname/ip-address and port, blocks until the handshake has finished.
+    // None of the connect functions can be called from on_connect or on_disconnect, they fail there.
     bool connect(const std::string& host, const uint16_t port, config cfg = config{})
     {
+      return connect_async(host, port, cfg).get();
+    }
+
+    // (ASYNC) Connect to server with hostname/ip-address and port. The future becomes true once
+    // the connection is ready or false if the first attempt failed, with config::reconnect set
+    // further attempts continue in the background.
+    std::future<bool> connect_async(const std::string& host, const uint16_t port, config cfg = config{})
+    {
+      return open_session(transport::tcp, host, port, nullptr, cfg);
+    }
+
+    // Connect to a server of this process, messages are handed over in memory without sockets,
+    // serialization or a handshake. The server has to be started, otherwise this fails after the
+    // handshake timeout. Blocks until the connection is ready. There is no reconnecting, the client
+    // cannot tell whether the server still exists.
+    bool connect_in_process(server_interface<T>& server, config cfg = config{})
+    {
+      return open_session(transport::in_process, std::string(), 0, &server, cfg).get();
+    }
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    // Connect to a server listening on a Unix domain socket at path, blocks until the handshake has finished
+    bool connect_local(const std::string& path, config cfg = config{})
+    {
+      return connect_local_async(path, cfg).get();
+    }
+
+    // (ASYNC) Connect to a server listening on a Unix domain socket, see connect_async
+    std::future<bool> connect_local_async(const std::string& path, config cfg = config{})
+    {
+      return open_session(transport::local, path, 0, nullptr, cfg);
+    }
+#endif
+
+    // Disconnect from server, messages that have not been written yet are dropped. Can be called
+    // from on_connect and on_disconnect, the context thread is then joined by the next connect from
+    // another thread or by the destructor.
+    void disconnect()
+    {
+      m_is_active = false;
+
+      // Handlers of this session that have not run yet are ignored from here on
+      m_session++;
+
+      {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        m_is_connected = false;
+        if (m_connection && m_connection->is_connected())
+          m_connection->disconnect();
+      }
+
+      end_session();
+    }
+
+    // Disconnect from server gracefully: the messages sent so far are written out within
+    // drain_timeout and the server closes its end once it has read them. Returns the number of
+    // messages dropped, messages buffered while not connected included. The drain runs on the
+    // context thread, so this cannot be called from on_connect or on_disconnect.
+    size_t disconnect(std::chrono::milliseconds drain_timeout)
+    {
+      if (m_asio_context.get_executor().running_in_this_thread())
+        throw std::runtime_error("A graceful disconnect cannot wait on the client's own context thread");
+
+      m_is_active = false;
+      m_session++;
+
+      auto drained = std::make_shared<std::promise<size_t>>();
+      auto future = drained->get_future();
+      size_t dropped = 0;
+      bool is_draining = false;
+      {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        m_is_connected = false;
+        dropped = m_messages_buffered.size();
+        if (m_connection && m_connection->is_connected() && m_thread_context.joinable())
+        {
+          m_connection->shutdown(drain_timeout, [drained](size_t count) { drained->set_value(count); });
+          is_draining = true;
+        }
+      }
+
+      if (is_draining)
+        dropped += future.get();
+
+      end_session();
+      if (dropped > 0)
+        NETRON_LOG_WARNING("Disconnect Dropped " << dropped << " Messages");
+      return dropped;
+    }
+
+    // Check if client is connected to server
+    bool is_connected() const
+    {
+      return m_is_connected;
+    }
+
+    // Send message to server. While the connection is being (re)established messages are
+    // buffered up to config::max_buffered_messages, returns false if the message was dropped.
+    bool send(const Message& msg)
+    {
+      std::lock_guard<std::mutex> lock(m_connection_mutex);
+      if (m_is_connected)
+      {
+        m_connection->send(msg);
+        return true;
+      }
+
+      if (m_is_active && m_messages_buffered.size() < m_config.max_buffered_messages)
+      {
+        m_messages_buffered.push_back(msg);
+        return true;
+      }
+
+      return false;
+    }
+
+    // Send message to server followed by a payload that is never copied into its body, see
+    // connection::send_payload. Nothing is buffered while not connected, returns false then.
+    bool send_payload(const Message& msg, payload data, std::function<void(std::error_code)> handler = nullptr)
+    {
+      std::lock_guard<std::mutex> lock(m_connection_mutex);
+      if (!m_is_connected)
+        return false;
+
+      m_connection->send_payload(msg, std::move(data), std::move(handler));
+      return true;
+    }
+
+    // Send message to server over the UDP channel, see connection::send_unreliable. Returns false if
+    // the message was not sent, nothing is buffered while the channel is not up.
+    bool send_unreliable(const Message& msg)
+    {
+      std::lock_guard<std::mutex> lock(m_connection_mutex);
+      return m_is_connected && m_connection->send_unreliable(msg);
+    }
+
+    // Hand the sends held back by config::coalesce_window to the I/O thread now, see connection::flush
+    void flush()
+    {
+      std::lock_guard<std::mutex> lock(m_connection_mutex);
+      if (m_is_connected)
+        m_connection->flush();
+    }
+
+    // (ASYNC) Send a request and call the handler with the server's reply, or with an error if
+    // there is no reply within the timeout. Any number of calls can be in flight at once.
+    void call(Message msg, CallHandler handler, std::chrono::milliseconds timeout)
+    {
+      if (!m_is_active)
+      {
+        Message empty;
+        handler(asio::error::not_connected, empty);
+        return;
+      }
+
+      const uint32_t correlation_id = next_correlation_id();
+      msg.header.correlation_id = correlation_id;
+
+      // Calls are only touched on the context thread, the reply can not overtake the registration
+      asio::post(m_asio_context,
+        [this, correlation_id, handler, timeout]()
+        {
+          auto timer = std::make_shared<asio::steady_timer>(m_asio_context, timeout);
+          timer->async_wait(
+            [this, correlation_id](std::error_code ec)
+            {
+              if (!ec)
+                complete_call(correlation_id, asio::error::timed_out);
+            }
+          );
+          m_calls[correlation_id] = { handler, timer };
+        }
+      );
+
+      if (!send(msg))
+        asio::post(m_asio_context, [this, correlation_id]() { complete_call(correlation_id, asio::error::not_connected); });
+    }
+
+    void call(Message msg, CallHandler handler)
+    {
+      call(std::move(msg), std::move(handler), std::chrono::milliseconds(m_config.call_timeout));
+    }
+
+    // (ASYNC) Send a request, the future holds the reply or throws std::system_error on failure
+    std::future<Message> call(Message msg, std::chrono::milliseconds timeout)
+    {
+      auto result = std::make_shared<std::promise<Message>>();
+      call(std::move(msg),
+        [result](std::error_code ec, Message& reply)
+        {
+          if (!ec)
+            result->set_value(std::move(reply));
+          else
+            result->set_exception(std::make_exception_ptr(std::system_error(ec)));
+        },
+        timeout
+      );
+      return result->get_future();
+    }
+
+    std::future<Message> call(Message msg)
+    {
+      return call(std::move(msg), std::chrono::milliseconds(m_config.call_timeout));
+    }
+
+    // Snapshot of the client's counters, summed over reconnects
+    client_metrics_snapshot metrics()
+    {
+      client_metrics_snapshot snapshot;
+      snapshot.connect_failures = m_connect_failures.load(std::memory_order_relaxed);
+      snapshot.reconnects = m_reconnects.load(std::memory_order_relaxed);
+      snapshot.late_replies = m_late_replies.load(std::memory_order_relaxed);
+      snapshot.incoming_queue_depth = m_messages_in.count();
+
+      std::lock_guard<std::mutex> lock(m_connection_mutex);
+      snapshot.totals = m_retired_metrics.snapshot();
+      if (m_connection)
+        snapshot.totals += m_connection->get_metrics();
+      return snapshot;
+    }
+
+    // Retrieve queue of incoming messages
+    tsqueue<owned_message<T>>& incoming()
+    {
+      return m_messages_in;
+    }
+
+    // Pass incoming messages to on_message, the same way server_interface::update does
+    void update(size_t max_messages = std::numeric_limits<size_t>::max(), bool wait = false)
+    {
+      if (wait)
+        m_messages_in.wait();
+
+      size_t message_count = 0;
+      while (message_count < max_messages && !m_messages_in.empty())
+      {
+        auto msg = m_messages_in.pop_front();
+        on_message(msg.msg);
+        message_count++;
+      }
+    }
+
+    // Instead of polling incoming(), have on_message called on the executor as soon as messages
+    // arrive. The executor must not run handlers after the client has been destroyed.
+    template<typename Executor>
+    void dispatch_messages(const Executor& executor)
+    {
+      m_messages_in.set_notifier(
+        [this, executor]()
+        {
+          asio::post(executor, [this]() { update(); });
+        }
+      );
+    }
+
+    // Go back to polling incoming()
+    void stop_dispatching_messages()
+    {
+      m_messages_in.set_notifier(nullptr);
+    }
+
+  protected:
+    // Called when the connection to the server is ready, after a reconnect as well
+    virtual void on_connect()
+    {
+
+    }
+
+    // Called when an established connection to the server has been lost
+    virtual void on_disconnect()
+    {
+
+    }
+
+    // Called by update() or a dispatching executor for every message from the server
+    virtual void on_message(Message& msg)
+    {
+
+    }
+
+  private:
+    enum class transport
+    {
+      tcp,
+      local,
+      in_process,
+    };
+
+    // Start a new connect/disconnect cycle. The host is the socket path for a local connection,
+    // server is set for an in-process one.
+    std::future<bool> open_session(transport type, const std::string& host, const uint16_t port, server_interface<T>* server, config cfg)
+    {
+      auto result = std::make_shared<std::promise<bool>>();
+      auto future = result->get_future();
+
+      // The context thread would have to replace itself, and a blocking connect wait for itself
+      if (m_asio_context.get_executor().running_in_this_thread())
+      {
+        NETRON_LOG_ERROR("Cannot connect from the client's own context thread");
+        result->set_value(false);
+        return future;
+      }
+
+      if (m_is_active)
+      {
+        result->set_value(false);
+        return future;
+      }
+
+      // Tidy up after a previous connection that has given up
+      disconnect();
+
       try
       {
         // Set config
         m_config = cfg;
+        m_host = host;
+        m_port = port;
+        m_transport = type;
+        m_in_process_server = server;
+        m_reconnect_attempts = 0;
+        m_has_connected = false;
+        m_is_active = true;
 
-        // Resolve hostname/ip-address into tangable physical address
-        asio::ip::tcp::resolver resolver(m_asio_context);
-        auto endpoints = resolver.resolve(host, std::to_string(port));
-
-        // Create connection
-        m_connection = std::make_unique<connection<T>>(
-          connection<T>::owner::client,
-          m_asio_context,
-          asio::ip::tcp::socket(m_asio_context),
-          m_messages_in,
-          m_config
-        );
+        // Keep the context running while there is no connection to wait on
+        m_asio_context.restart();
+        m_work_guard = std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(m_asio_context.get_executor());
 
-        // Tell the connection object to connect to server
-        m_connection->connect_to_server(endpoints);
+        // Resolve and connect, or attach to the in-process server, on the context thread
+        start_connect(result);
 
         // Start the context thread
         m_thread_context = std::thread([this]() { m_asio_context.run(); });
       }
       catch(std::exception& e)
       {
-        std::cerr << "Client Exception: " << e.what() << '\n';
-        return false;
+        NETRON_LOG_ERROR("Client Exception: " << e.what());
+        m_is_active = false;
+        result->set_value(false);
       }
-      
-      return false;
+
+      return future;
     }
 
-    // Disconnect from server
-    void disconnect()
+    // (ASYNC) Resolve the server's address and start a new connection to it
+    void start_connect(std::shared_ptr<std::promise<bool>> result)
+    {
+      const uint32_t session = m_session;
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+      if (m_transport == transport::local)
+      {
+        asio::post(m_asio_context,
+          [this, session, result]()
+          {
+            if (session != m_session)
+              return;
+
+            const std::vector<stream_protocol::endpoint> endpoints{ asio::local::stream_protocol::endpoint(m_host) };
+            make_connection(session)->connect_to_server(endpoints,
+              [this, session, result](std::error_code ec) { connect_finished(session, ec, result); },
+              [this, session](std::error_code ec) { connection_lost(session, ec); }
+            );
+          }
+        );
+        return;
+      }
+#endif
+
+      if (m_transport == transport::in_process)
+      {
+        asio::post(m_asio_context,
+          [this, session, result]()
+          {
+            if (session != m_session)
+              return;
+
+            make_connection(session)->connect_to_server_in_process(*m_in_process_server,
+              [this, session, result](std::error_code ec) { connect_finished(session, ec, result); },
+              [this, session](std::error_code ec) { connection_lost(session, ec); }
+            );
+          }
+        );
+        return;
+      }
+
+      auto resolver = std::make_shared<asio::ip::tcp::resolver>(m_asio_context);
+      resolver->async_resolve(m_host, std::to_string(m_port),
+        [this, session, resolver, result](std::error_code ec, asio::ip::tcp::resolver::results_type endpoints)
+        {
+          if (session != m_session)
+            return;
+
+          if (ec)
+          {
+            connect_finished(session, ec, result);
+            return;
+          }
+
+          // Tell the connection object to connect to server
+          make_connection(session)->connect_to_server(endpoints,
+            [this, session, result](std::error_code ec) { connect_finished(session, ec, result); },
+            [this, session](std::error_code ec) { connection_lost(session, ec); }
+          );
+        }
+      );
+    }
+
+    // Create the connection of a new attempt and make it the current one
+    std::shared_ptr<connection<T>> make_connection(uint32_t session)
+    {
+      auto new_connection = std::make_shared<connection<T>>(
+        connection<T>::owner::client,
+        m_asio_context,
+        stream_protocol::socket(m_asio_context),
+        m_messages_in,
+        m_config
+      );
+
+      {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        retire_connection();
+        m_connection = new_connection;
+      }
+
+      // Replies to calls complete them instead of going to the incoming queue
+      new_connection->set_reply_handler(
+        [this, session](Message& msg)
+        {
+          if (session == m_session)
+            complete_call(msg.header.correlation_id, std::error_code(), &msg);
+        }
+      );
+
+      return new_connection;
+    }
+
+    // Called on the context thread once a connection attempt has finished
+    void connect_finished(uint32_t session, std::error_code ec, std::shared_ptr<std::promise<bool>> result)
+    {
+      if (session != m_session)
+        return;
+
+      if (!ec)
+      {
+        m_reconnect_attempts = 0;
+        if (m_has_connected)
+          m_reconnects.fetch_add(1, std::memory_order_relaxed);
+        m_has_connected = true;
+
+        {
+          // Messages buffered while disconnected go out before any new ones
+          std::lock_guard<std::mutex> lock(m_connection_mutex);
+          for (auto& msg : m_messages_buffered)
+            m_connection->send(msg);
+          m_messages_buffered.clear();
+          m_is_connected = true;
+        }
+
+        on_connect();
+      }
+      else
+      {
+        NETRON_LOG_WARNING("Connect Fail: " << ec.message());
+        m_connect_failures.fetch_add(1, std::memory_order_relaxed);
+        schedule_reconnect(session);
+      }
+
+      if (result)
+        result->set_value(!ec);
+    }
+
+    // Called on the context thread when an established connection drops
+    void connection_lost(uint32_t session, std::error_code ec)
     {
-      if (is_connected())
-        m_connection->disconnect();
+      if (session != m_session)
+        return;
 
+      {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        m_is_connected = false;
+      }
+
+      // Requests in flight are lost with the connection
+      fail_calls(asio::error::connection_reset);
+
+      on_disconnect();
+      schedule_reconnect(session);
+    }
+
+    // Stop the context of an ended session. What has been posted to it runs first, so a close
+    // reaches the server before the context stops. A handler on the context thread cannot wait for
+    // it, the context stops once the handler returns and the thread is joined later.
+    void end_session()
+    {
+      const bool is_context_thread = m_asio_context.get_executor().running_in_this_thread();
+      if (m_thread_context.joinable() && !is_context_thread && !m_asio_context.stopped())
+      {
+        std::promise<void> idle;
+        asio::post(m_asio_context, [&idle]() { idle.set_value(); });
+        idle.get_future().wait();
+      }
+
+      m_work_guard.reset();
       m_asio_context.stop();
-      if (m_thread_context.joinable())
+      if (m_thread_context.joinable() && !is_context_thread)
         m_thread_context.join();
 
-      m_connection.release();
+      m_reconnect_timer.cancel();
+      fail_calls(asio::error::operation_aborted);
+
+      std::lock_guard<std::mutex> lock(m_connection_mutex);
+      retire_connection();
+      m_messages_buffered.clear();
     }
 
-    // Check if client is connected to server
-    bool is_connected() const
+    // Keep the counters of the current connection and drop it, called under the connection lock
+    void retire_connection()
     {
       if (m_connection)
-        return m_connection->is_connected();
-      else
-        return false;
+        m_retired_metrics.add(m_connection->get_metrics());
+      m_connection.reset();
     }
 
-    // Send message to server
-    void send(const Message& msg)
+    uint32_t next_correlation_id()
     {
-      if (is_connected())
-        m_connection->send(msg);
+      // The top bit is taken by the reply flag on the wire
+      uint32_t id = m_correlation_counter++ & ~reply_bit;
+      while (id == 0)
+        id = m_correlation_counter++ & ~reply_bit;
+      return id;
     }
 
-    // Retrieve queue of incoming messages
-    tsqueue<owned_message<T>>& incoming()
+    // Finish a pending call, replies to calls that have already timed out are dropped and counted
+    void complete_call(uint32_t correlation_id, std::error_code ec, Message* reply = nullptr)
     {
-      return m_messages_in;
+      auto it = m_calls.find(correlation_id);
+      if (it == m_calls.end())
+      {
+        if (reply)
+          m_late_replies.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+
+      auto pending = std::move(it->second);
+      m_calls.erase(it);
+      pending.timer->cancel();
+
+      Message empty;
+      pending.handler(ec, reply ? *reply : empty);
+    }
+
+    // Fail every pending call
+    void fail_calls(std::error_code ec)
+    {
+      auto calls = std::move(m_calls);
+      m_calls.clear();
+
+      Message empty;
+      for (auto& c : calls)
+      {
+        c.second.timer->cancel();
+        c.second.handler(ec, empty);
+      }
+    }
+
+    // (ASYNC) Try to connect again after a randomized, exponentially growing delay
+    void schedule_reconnect(uint32_t session)
+    {
+      // An in-process server may be gone with the connection, it is not touched again
+      if (!m_config.reconnect || !m_is_active || m_transport == transport::in_process)
+      {
+        m_is_active = false;
+        return;
+      }
+
+      // The delay is drawn from the upper half of the current bound, so clients that lost
+      // the same server spread their attempts out instead of reconnecting all at once
+      const uint32_t shift = std::min(m_reconnect_attempts++, 20u);
+      const uint64_t bound = std::min<uint64_t>(uint64_t(m_config.reconnect_delay_min) << shift, m_config.reconnect_delay_max);
+      std::uniform_int_distribution<uint64_t> distribution(bound / 2, bound);
+
+      m_reconnect_timer.expires_after(std::chrono::milliseconds(distribution(m_random)));
+      m_reconnect_timer.async_wait(
+        [this, session](std::error_code ec)
+        {
+          if (!ec && session == m_session && m_is_active)
+            start_connect(nullptr);
+        }
+      );
     }
 
   protected:
@@ -102,8 +631,8 @@ namespace netron
     // Thread of execution for the asio context
     std::thread m_thread_context;
 
-    // A single instance of a connection object to server
-    std::unique_ptr<connection<T>> m_connection;
+    // A single instance of a connection object to server, replaced on reconnect
+    std::shared_ptr<connection<T>> m_connection;
 
     // Client's configuration
     config m_config;
@@ -111,6 +640,50 @@ namespace netron
   private:
     // This queue holds all incoming messages from the server
     tsqueue<owned_message<T>> m_messages_in;
+
+    // Keeps the context running between connection attempts
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> m_work_guard;
+
+    // Address of the server, kept for reconnecting
+    transport m_transport = transport::tcp;
+    std::string m_host;
+    uint16_t m_port = 0;
+    server_interface<T>* m_in_process_server = nullptr;
+
+    // Guards the connection and the buffered messages, both are touched by the caller and the context thread
+    std::mutex m_connection_mutex;
+    std::deque<Message> m_messages_buffered;
+
+    // The connection is ready for messages
+    std::atomic<bool> m_is_connected{ false };
+
+    // Connecting or connected, cleared by disconnect or when giving up
+    std::atomic<bool> m_is_active{ false };
+
+    // Identifies handlers of the current connect/disconnect cycle, bumped by the caller and read by
+    // handlers on the context thread
+    std::atomic<uint32_t> m_session{ 0 };
+
+    // Reconnect with backoff
+    asio::steady_timer m_reconnect_timer;
+    uint32_t m_reconnect_attempts = 0;
+    std::mt19937_64 m_random;
+
+    // Calls waiting for their reply, only touched on the context thread
+    struct pending_call
+    {
+      CallHandler handler;
+      std::shared_ptr<asio::steady_timer> timer;
+    };
+    std::unordered_map<uint32_t, pending_call> m_calls;
+    std::atomic<uint32_t> m_correlation_counter{ 1 };
+
+    // Counters for metrics(), connections replaced on reconnect are folded into the retired totals
+    std::atomic<uint64_t> m_connect_failures{ 0 };
+    std::atomic<uint64_t> m_reconnects{ 0 };
+    std::atomic<uint64_t> m_late_replies{ 0 };
+    bool m_has_connected = false;
+    connection_metrics m_retired_metrics;
   };
 
 }
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <netron/common.hpp>
+#include <netron/asio.hpp>
+#include <netron/log.hpp>
+#include <netron/tsqueue.hpp>
+#include <netron/message.hpp>
+#include <netron/connection.hpp>
+#include <netron/config.hpp>
+
+namespace netron
+{
+
+  // Hosts many client connections on a fixed number of I/O threads, each thread runs its own
+  // context and connections are spread over them. Messages from all connections arrive in one
+  // queue, tagged with the connection they came from.
+  template<typename T>
+  class client_pool
+  {
+  public:
+    using Connection = std::shared_ptr<connection<T>>;
+    using Message = message<T>;
+
+    client_pool(uint32_t thread_count = std::thread::hardware_concurrency(), config cfg = config{})
+      : m_config(cfg)
+    {
+      for (uint32_t i = 0; i < std::max(1u, thread_count); ++i)
+        m_threads.push_back(std::make_unique<io_thread>());
+
+      for (auto& t : m_threads)
+      {
+        auto& context = t->context;
+        t->thread = std::thread([&context]() { context.run(); });
+      }
+    }
+
+    virtual ~client_pool()
+    {
+      stop();
+
+      // Queued messages hold their connections, which must go before the threads' contexts
+      m_messages_in.clear();
+    }
+
+    // (ASYNC) Resolve the server once and open count connections to it
+    void connect(const std::string& host, const uint16_t port, uint32_t count = 1)
+    {
+      auto resolver = std::make_shared<asio::ip::tcp::resolver>(next_thread().context);
+      resolver->async_resolve(host, std::to_string(port),
+        [this, resolver, count](std::error_code ec, asio::ip::tcp::resolver::results_type endpoints)
+        {
+          if (ec)
+          {
+            NETRON_LOG_ERROR("Resolve Fail: " << ec.message());
+            return;
+          }
+
+          for (uint32_t i = 0; i < count; ++i)
+            open_connection(endpoints);
+        }
+      );
+    }
+
+    // Close all connections and stop the I/O threads
+    void stop()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_connections_mutex);
+        for (auto& c : m_connections)
+          c->disconnect();
+        m_connections.clear();
+      }
+
+      for (auto& t : m_threads)
+      {
+        t->work_guard.reset();
+        t->context.stop();
+      }
+
+      for (auto& t : m_threads)
+        if (t->thread.joinable())
+          t->thread.join();
+    }
+
+    // Number of connections that are ready for messages
+    size_t count()
+    {
+      std::lock_guard<std::mutex> lock(m_connections_mutex);
+      return m_connections.size();
+    }
+
+    // Returns a snapshot of the connections that are ready for messages
+    std::vector<Connection> connections()
+    {
+      std::lock_guard<std::mutex> lock(m_connections_mutex);
+      return std::vector<Connection>(m_connections.begin(), m_connections.end());
+    }
+
+    // Send a message to all connections
+    void message_all(const Message& msg)
+    {
+      std::lock_guard<std::mutex> lock(m_connections_mutex);
+      for (auto& c : m_connections)
+        if (c->is_connected())
+          c->send(msg);
+    }
+
+    // Retrieve queue of incoming messages from all connections
+    tsqueue<owned_message<T>>& incoming()
+    {
+      return m_messages_in;
+    }
+
+  protected:
+    // Called on an I/O thread when a connection is ready
+    virtual void on_connect(Connection connection)
+    {
+
+    }
+
+    // Called on an I/O thread when a connection attempt has failed
+    virtual void on_connect_fail(Connection connection, std::error_code ec)
+    {
+
+    }
+
+    // Called on an I/O thread when a ready connection has been lost
+    virtual void on_disconnect(Connection connection)
+    {
+
+    }
+
+  private:
+    // A context and the thread running it
+    struct io_thread
+    {
+      io_thread()
+        : work_guard(asio::make_work_guard(context))
+      {}
+
+      asio::io_context context;
+      asio::executor_work_guard<asio::io_context::executor_type> work_guard;
+      std::thread thread;
+    };
+
+    // Connections are assigned to the threads round-robin
+    io_thread& next_thread()
+    {
+      return *m_threads[m_next_thread++ % m_threads.size()];
+    }
+
+    // (ASYNC) Create a connection on the next thread and start its handshake there
+    void open_connection(const asio::ip::tcp::resolver::results_type& endpoints)
+    {
+      auto& context = next_thread().context;
+      auto new_connection = std::make_shared<connection<T>>(
+        connection<T>::owner::client,
+        context,
+        stream_protocol::socket(context),
+        m_messages_in,
+        m_config
+      );
+
+      // The handlers are stored in the connection itself, a weak reference avoids a cycle
+      std::weak_ptr<connection<T>> weak = new_connection;
+      const uint32_t uid = m_id_counter++;
+      asio::post(context,
+        [this, new_connection, weak, endpoints, uid]()
+        {
+          new_connection->connect_to_server(endpoints,
+            [this, weak](std::error_code ec) { connect_finished(weak.lock(), ec); },
+            [this, weak](std::error_code ec) { connection_lost(weak.lock()); },
+            uid
+          );
+        }
+      );
+    }
+
+    // Called on the connection's thread once its handshake has finished
+    void connect_finished(Connection c, std::error_code ec)
+    {
+      if (!c)
+        return;
+
+      if (!ec)
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_connections_mutex);
+          m_connections.insert(c);
+        }
+        on_connect(c);
+      }
+      else
+      {
+        on_connect_fail(c, ec);
+      }
+    }
+
+    // Called on the connection's thread when a ready connection drops
+    void connection_lost(Connection c)
+    {
+      if (!c)
+        return;
+
+      {
+        std::lock_guard<std::mutex> lock(m_connections_mutex);
+        m_connections.erase(c);
+      }
+      on_disconnect(c);
+    }
+
+  protected:
+    // Incoming messages from all connections
+    tsqueue<owned_message<T>> m_messages_in;
+
+    // Connections that are ready for messages
+    std::unordered_set<Connection> m_connections;
+    std::mutex m_connections_mutex;
+
+    // I/O threads shared by all connections
+    std::vector<std::unique_ptr<io_thread>> m_threads;
+    std::atomic<uint32_t> m_next_thread{ 0 };
+
+    // Unique identifier for a connection
+    std::atomic<uint32_t> m_id_counter{ 1 };
+
+    // Configuration of every connection
+    config m_config;
+  };
+
+}
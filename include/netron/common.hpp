@@ -3,10 +3,27 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <deque>
+#include <array>
+#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstddef>
 #include <iterator>
+#include <functional>
+#include <future>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <condition_variable>
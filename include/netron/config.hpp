@@ -13,12 +13,115 @@ namespace netron
   struct config
   {
     endian endian = endian::native;
-    protocol_version version = "1.0"_pv;
+
+    // Peers of another version are rejected in the handshake. 1.0 peers sent their whole config,
+    // from 2.0 on only a wire_config is exchanged.
+    protocol_version version = "2.0"_pv;
     uint32_t max_connections = std::numeric_limits<uint32_t>::max();
     byte_size max_message_size = 10_MB;
+
+    // Message bodies of at least this size are received into a memory-mapped temporary file instead
+    // of the heap, see message::spooled (in bytes, 0 disables, not on Windows)
+    byte_size spool_threshold = 0;
+
+    // Connections that have not finished the handshake in time are dropped (in milliseconds, 0 disables)
+    uint32_t handshake_timeout = 10000;
+
+    // Accepting is paused while this many connections are still in the handshake
+    uint32_t max_pending_connections = 1024;
+
+    // Accepting is throttled to this many new connections per second
+    uint32_t max_accept_rate = std::numeric_limits<uint32_t>::max();
+
+    // Messages and bytes each connection may deliver per second, in bursts of up to one second's
+    // worth. Reading from a socket over its limit pauses until it is back within it, which leaves
+    // the sender to TCP flow control instead of buffering its messages.
+    uint32_t max_message_rate = std::numeric_limits<uint32_t>::max();
+    byte_size max_byte_rate = std::numeric_limits<byte_size>::max();
+
+    // Number of acceptors sharing the port with SO_REUSEPORT, each with its own I/O thread
+    uint32_t acceptor_count = 1;
+
+    // Disables Nagle's algorithm, a write carries every message queued when it starts
+    bool tcp_no_delay = true;
+
+    // Sends made within this window are handed to the I/O thread together and leave in one gathered
+    // write, connection::flush hands them over early (in microseconds, 0 disables)
+    uint32_t coalesce_window = 0;
+
+    // A coalesced batch is handed over as soon as it holds this many bytes
+    byte_size coalesce_bytes = 64_KB;
+
+    // Acknowledges received data immediately instead of delaying the ACK (Linux only)
+    bool tcp_quick_ack = false;
+
+    // Enables TCP keep-alive probes on idle connections
+    bool keep_alive = false;
+
+    // Every message on the socket carries a CRC32C of its header and body when both ends ask for it,
+    // catching corruption TCP's own checksum lets through. Shared memory and in-process skip it.
+    bool checksum = false;
+
+    // Connections over TCP also open a UDP channel for connection::send_unreliable when both ends ask
+    // for it, the server receives datagrams on its TCP port number
+    bool udp = false;
+
+    // Kernel socket buffer sizes in bytes, 0 keeps the system defaults
+    uint32_t send_buffer_size = 0;
+    uint32_t receive_buffer_size = 0;
+
+    // Clients reconnect after a lost connection, waiting a random delay below an exponentially
+    // growing bound, starting at reconnect_delay_min and capped at reconnect_delay_max (in milliseconds)
+    bool reconnect = false;
+    uint32_t reconnect_delay_min = 100;
+    uint32_t reconnect_delay_max = 30000;
+
+    // Messages sent while the client is not connected are held up to this count and sent on reconnect
+    uint32_t max_buffered_messages = 1024;
+
+    // Calls that have not been replied to in time fail (in milliseconds)
+    uint32_t call_timeout = 30000;
+
+    // Connections over a Unix domain socket move their messages to a shared-memory ring once both
+    // ends ask for it, the socket is only kept to notice the peer going away (Linux only)
+    bool shared_memory = false;
+
+    // Size of the ring of each direction in bytes, rounded up to a power of two, the server's value is used
+    byte_size shared_memory_size = 4_MB;
+
+    // Time a connection keeps polling its empty ring before it sleeps on its eventfd, trades a busy
+    // I/O thread for latency (in microseconds)
+    uint32_t shared_memory_spin = 0;
   };
 #pragma pack(pop)
 
   using config_view = const config&;
 
+  // Layout of wire_config, bumped whenever its fields change
+  constexpr uint16_t wire_config_format = 1;
+
+#pragma pack(push, 1)
+  // The part of a config both ends of a connection have to agree on, exchanged in the handshake.
+  // The rest of config only concerns the end that set it and stays local.
+  struct wire_config
+  {
+    // Compared before the rest is read, a peer that differs in these may send another layout
+    endian endian = endian::native;
+    protocol_version version;
+    uint16_t format = wire_config_format;
+
+    byte_size max_message_size = 0;
+
+    // Both ends have to frame messages with the same header and accept the same ids, see message_id_traits
+    uint8_t wire_header_size = 0;
+    uint64_t message_ids_hash = 0;
+
+    // Features used when both ends ask for them
+    bool checksum = false;
+    bool udp = false;
+    bool shared_memory = false;
+    byte_size shared_memory_size = 0;
+  };
+#pragma pack(pop)
+
 }
@@ -2,9 +2,19 @@
 
 #include <netron/common.hpp>
 #include <netron/asio.hpp>
+#include <netron/log.hpp>
 #include <netron/tsqueue.hpp>
+#include <netron/mpsc_queue.hpp>
+#include <netron/token_bucket.hpp>
 #include <netron/message.hpp>
+#include <netron/spool.hpp>
 #include <netron/config.hpp>
+#include <netron/metrics.hpp>
+#include <netron/transport.hpp>
+#include <netron/shared_memory.hpp>
+#include <netron/datagram.hpp>
+#include <netron/payload.hpp>
+#include <netron/crc32c.hpp>
 
 namespace netron 
 {
@@ -13,6 +23,15 @@ namespace netron
   template<typename T>
   class server_interface;
 
+  // Queued messages written with one gather write, two buffers each, within the 64 buffers asio
+  // passes to a single writev or io_uring submission
+  constexpr size_t max_write_batch = 32;
+
+  // File payloads are handed to sendfile this many bytes at a time before the thread is yielded to
+  // the other connections, and copied through a buffer of this size where sendfile is unavailable
+  constexpr uint64_t max_file_write = 16 * 1024 * 1024;
+  constexpr size_t file_copy_chunk = 256 * 1024;
+
   template<typename T>
   class connection : public std::enable_shared_from_this<connection<T>>
   {
@@ -23,13 +42,20 @@ namespace netron
       client
     };
 
-    connection(owner parent, asio::io_context& asio_context, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& messages_in, config_view owner_config)
-      : m_asio_context(asio_context), m_socket(std::move(socket)), m_messages_in(messages_in), m_owner_config(owner_config)
+    connection(owner parent, asio::io_context& asio_context, stream_protocol::socket socket, tsqueue<owned_message<T>>& messages_in, config_view owner_config)
+      : m_asio_context(asio_context), m_socket(std::move(socket)), m_messages_in(messages_in), m_owner_config(owner_config), m_handshake_timer(asio_context), m_udp_timer(asio_context), m_coalesce_timer(asio_context), m_read_timer(asio_context), m_drain_timer(asio_context)
     {
       m_owner_type = parent;
 
+      if (m_owner_config.max_message_rate != std::numeric_limits<uint32_t>::max())
+        m_message_bucket = token_bucket(m_owner_config.max_message_rate);
+      if (m_owner_config.max_byte_rate != std::numeric_limits<byte_size>::max())
+        m_byte_bucket = token_bucket(double(m_owner_config.max_byte_rate));
+
       if (m_owner_type == owner::server)
       {
+        apply_socket_options();
+
         // Naive implementation. It only protects against accidental connections.
         m_handshake_out = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
 
@@ -44,15 +70,36 @@ namespace netron
     }
 
     virtual ~connection()
-    {}
+    {
+      // An in-process peer has no socket that would tell it about this end going away
+      close_in_process_peer();
+    }
 
     uint32_t get_id() const
     {
       return m_id;
     }
 
-    auto get_endpoint() const
+    // Executor of the context this connection runs on, e.g. to co_spawn coroutines for it
+    auto get_executor()
+    {
+      return m_asio_context.get_executor();
+    }
+
+    // Counters of this connection, safe to call from any thread
+    connection_metrics_snapshot get_metrics()
+    {
+      auto snapshot = m_metrics.snapshot();
+      snapshot.id = m_id;
+      snapshot.outgoing_queue_depth = m_messages_out.count() + m_pending_sends.load(std::memory_order_relaxed);
+      return snapshot;
+    }
+
+    // Address of the remote end, a TCP or Unix domain socket address, empty for in-process connections
+    stream_protocol::endpoint get_endpoint() const
     {
+      if (m_is_in_process)
+        return stream_protocol::endpoint();
       return m_socket.remote_endpoint();
     }
 
@@ -68,333 +115,2100 @@ namespace netron
         if (m_socket.is_open())
         {
           m_id = uid;
+          start_handshake_timer();
           write_validation();
           read_validation(server);
         }
       }
     }
 
-    void connect_to_server(const asio::ip::tcp::resolver::results_type& endpoints)
+    // on_connect is called once the handshake has finished or failed,
+    // on_disconnect once an established connection drops afterwards
+    void connect_to_server(const asio::ip::tcp::resolver::results_type& endpoints,
+      std::function<void(std::error_code)> on_connect = nullptr, std::function<void(std::error_code)> on_disconnect = nullptr, uint32_t uid = 0)
+    {
+      connect_to_server(to_endpoints(endpoints), std::move(on_connect), std::move(on_disconnect), uid);
+    }
+
+    // Endpoints are tried in order, e.g. a single asio::local::stream_protocol::endpoint for a Unix domain socket
+    void connect_to_server(const std::vector<stream_protocol::endpoint>& endpoints,
+      std::function<void(std::error_code)> on_connect = nullptr, std::function<void(std::error_code)> on_disconnect = nullptr, uint32_t uid = 0)
     {
       if (m_owner_type == owner::client)
       {
+        m_id = uid;
+        m_connect_handler = std::move(on_connect);
+        m_disconnect_handler = std::move(on_disconnect);
+        start_handshake_timer();
+
+        auto self = this->shared_from_this();
         asio::async_connect(m_socket, endpoints,
-          [this](std::error_code ec, asio::ip::tcp::endpoint endpoint)
+          [this, self](std::error_code ec, stream_protocol::endpoint endpoint)
           {
             if (!ec)
             {
+              apply_socket_options();
               read_validation();
             }
+            else
+            {
+              close_socket(ec);
+            }
           }
         );
       }
     }
 
-    void disconnect()
+    // (In-process) Connect to a server of this process. There is no socket and no handshake, the
+    // server links its side of the connection to this one and messages are handed over in memory.
+    void connect_to_server_in_process(server_interface<T>& server,
+      std::function<void(std::error_code)> on_connect = nullptr, std::function<void(std::error_code)> on_disconnect = nullptr, uint32_t uid = 0)
     {
-      if (is_connected())
-        asio::post(m_asio_context, [this]() { m_socket.close(); });
-    }
+      if (m_owner_type == owner::client)
+      {
+        m_id = uid;
+        m_connect_handler = std::move(on_connect);
+        m_disconnect_handler = std::move(on_disconnect);
+        m_is_in_process = true;
 
-    bool is_connected() const
-    {
-      return m_socket.is_open();
+        // A stopped server never gets to the connection, the handshake timeout fails it instead
+        start_handshake_timer();
+        server.accept_in_process(this->shared_from_this());
+      }
     }
 
-    // (ASYNC) Send a message to the remote end of this connection
-    void send(const message<T>& msg)
+    // (In-process) Called by the server on its context, links this server side connection with the
+    // client's and makes both ready
+    void connect_to_client_in_process(server_interface<T>* server, uint32_t uid, std::shared_ptr<connection<T>> client)
     {
-      if (!m_is_ready)
-        throw std::runtime_error("Connection is not ready to send messages");
+      if (m_owner_type != owner::server)
+        return;
 
-      asio::post(m_asio_context,
-        [this, msg]()
-        {
-          bool is_writing_message = !m_messages_out.empty();
-          m_messages_out.push_back(msg);
-          if (!is_writing_message)
-          {
-            write_header();
-          }
-        }
-      );
-    }
+      m_id = uid;
+      m_is_in_process = true;
+      m_peer = client;
+      m_remote_config = to_wire_config(client->m_owner_config);
 
-  private:
-    // (ASYNC) Prime context ready to write a message
-    void write_header()
-    {
-      if (m_messages_out.front().size() > m_remote_config.max_message_size)
-        throw std::runtime_error("Message size exceeds maximum message size");
+      if (!is_remote_config_compatible())
+      {
+        NETRON_LOG_WARNING("[" << get_id() << "] Client Disconnected (Config Fail)");
+        client->reject_in_process(std::make_error_code(std::errc::protocol_not_supported));
+        return;
+      }
+
+      auto self = this->shared_from_this();
+      server->on_client_validated(self);
+      server->on_client_config_validated(self);
+      m_is_in_process_open = true;
+      m_is_ready = true;
 
-      asio::async_write(m_socket, asio::buffer(&m_messages_out.front().header, sizeof(message_header<T>)),
-        [this](std::error_code ec, std::size_t length)
+      // The client becomes ready on its own context, before anything the server sends from on_client_ready arrives
+      std::weak_ptr<connection<T>> weak_self = self;
+      const wire_config server_config = to_wire_config(m_owner_config);
+      asio::post(client->m_asio_context,
+        [client, weak_self, server_config]()
         {
-          if (!ec)
-          {
-            if (m_messages_out.front().body.size() > 0)
-            {
-              write_body();
-            }
-            else
-            {
-              m_messages_out.pop_front();
+          client->m_peer = weak_self;
+          client->m_remote_config = server_config;
+          client->m_is_in_process_open = true;
 
-              if (!m_messages_out.empty())
-              {
-                write_header();
-              }
-            }
-          }
-          else
+          // The client has timed out or disconnected meanwhile, its connect handler is gone with it
+          if (!client->m_connect_handler)
           {
-            std::cout << "[" << get_id() << "] Write Header Fail.\n";
-            m_socket.close();
+            client->close_in_process_peer();
+            return;
           }
+
+          client->m_handshake_timer.cancel();
+          client->m_is_ready = true;
+
+          std::function<void(std::error_code)> handler;
+          handler.swap(client->m_connect_handler);
+          if (handler)
+            handler(std::error_code());
         }
       );
+
+      server->on_client_ready(self);
     }
 
-    // (ASYNC) Prime context ready to write a message body
-    void write_body()
+    // (In-process) The server refused the connection
+    void reject_in_process(std::error_code reason)
     {
-      asio::async_write(m_socket, asio::buffer(m_messages_out.front().body.data(), m_messages_out.front().body.size()),
-        [this](std::error_code ec, std::size_t length)
-        {
-          if (!ec)
-          {
-            m_messages_out.pop_front();
+      auto self = this->shared_from_this();
+      asio::post(m_asio_context, [this, self, reason]() { close_socket(reason); });
+    }
 
-            if (!m_messages_out.empty())
-            {
-              write_header();
-            }
-          }
-          else
-          {
-            std::cout << "[" << get_id() << "] Write Body Fail.\n";
-            m_socket.close();
-          }
-        }
-      );
+    // Replies with a correlation id are passed to this handler instead of the incoming queue,
+    // set before the connection is established
+    void set_reply_handler(std::function<void(message<T>&)> handler)
+    {
+      m_reply_handler = std::move(handler);
     }
 
-    // (ASYNC) Prime context ready to read a message header
-    void read_header()
+    void disconnect()
     {
-      asio::async_read(m_socket, asio::buffer(&m_msg_temp_in.header, sizeof(message_header<T>)),
-        [this](std::error_code ec, std::size_t length)
-        {
-          if (!ec && m_msg_temp_in.header.size <= m_owner_config.max_message_size)
-          {
-            if (m_msg_temp_in.header.size > 0)
-            {
-              m_msg_temp_in.body.resize(m_msg_temp_in.header.size);
-              read_body();
-            }
-            else
-            {
-              add_to_incoming_message_queue();
-            }
-          }
-          else
-          {
-            std::cout << "[" << get_id() << "] Read Header Fail.\n";
-            m_socket.close();
-          }
-        }
-      );
+      const bool was_connected = is_connected();
+
+      // The owner may stop this end's context right away, the peer is told directly
+      close_in_process_peer();
+
+      if (was_connected)
+      {
+        // Coalesced sends are queued ahead of the close, like any other send made before it
+        flush();
+
+        // Closes right away on the context thread, whose owner may stop it before a post would run
+        auto self = this->shared_from_this();
+        asio::dispatch(m_asio_context, [this, self]() { close_socket(asio::error::operation_aborted); });
+      }
     }
 
-    // (ASYNC) Prime context ready to read a message body
-    void read_body()
+    // (ASYNC) Close gracefully: the messages sent so far are written out, the socket is half-closed
+    // and the remote closes its end once it has read everything. Whatever is still queued when the
+    // timeout runs out is dropped, the handler is called with the number of dropped messages once
+    // the connection is closed.
+    void shutdown(std::chrono::steady_clock::duration timeout, std::function<void(size_t)> handler)
     {
-      asio::async_read(m_socket, asio::buffer(m_msg_temp_in.body.data(), m_msg_temp_in.body.size()),
-        [this](std::error_code ec, std::size_t length)
+      // Coalesced sends are queued ahead of the shutdown
+      flush();
+
+      auto self = this->shared_from_this();
+      asio::post(m_asio_context,
+        [this, self, timeout, handler]()
         {
-          if (!ec)
+          if (!is_connected())
           {
-            add_to_incoming_message_queue();
+            handler(0);
+            return;
           }
-          else
+
+          m_shutdown_handler = handler;
+          if (m_is_in_process)
           {
-            std::cout << "[" << get_id() << "] Read Body Fail.\n";
-            m_socket.close();
+            // Messages are handed to the peer as they are sent, nothing is left to write
+            close_socket(asio::error::operation_aborted);
+            return;
           }
+
+          m_drain_deadline = std::chrono::steady_clock::now() + timeout;
+          drain_submitted();
+          wait_for_drain();
         }
       );
     }
 
-    // Add incoming message to queue
-    void add_to_incoming_message_queue()
+    bool is_connected() const
     {
-      if (m_owner_type == owner::server)
-        m_messages_in.push_back({ this->shared_from_this(), m_msg_temp_in });
-      else
-        m_messages_in.push_back({ nullptr, m_msg_temp_in });
+      if (m_is_in_process)
+        return m_is_in_process_open;
+      return m_socket.is_open();
+    }
 
-      read_header();
+    // Returns true once the handshake has finished and messages can be sent
+    bool is_ready() const
+    {
+      return m_is_ready;
     }
 
-    // Naive implementation. It only protects against accidental connections.
-    uint64_t scramble(uint64_t value)
+    // (ASYNC) Send a message to the remote end of this connection
+    void send(const message<T>& msg)
     {
-      uint64_t out = value ^ 0xCF2911F740C52729;
-      out = (out & 0xF0F0F0F0F0F0F0) >> 4 | (out & 0x0F0F0F0F0F0F0F) << 4;
-      return out ^ 0xAF1163442D8647C0;
+      if (!m_is_ready)
+        throw std::runtime_error("Connection is not ready to send messages");
+
+      const auto queued_at = std::chrono::steady_clock::now();
+      if (m_is_in_process)
+      {
+        send_in_process(msg, nullptr, queued_at);
+        return;
+      }
+
+      submit({ msg, nullptr, queued_at });
     }
 
-    // (ASYNC) Prime context ready to write validation
-    void write_validation()
+    // (ASYNC) Send a message, the completion token is invoked with void(std::error_code) once
+    // the message has been fully written, e.g. co_await conn->send(msg, asio::use_awaitable)
+    template<typename CompletionToken>
+    auto send(const message<T>& msg, CompletionToken&& token)
     {
-      asio::async_write(m_socket, asio::buffer(&m_handshake_out, sizeof(uint64_t)),
-        [this](std::error_code ec, std::size_t length)
+      return asio::async_initiate<CompletionToken, void(std::error_code)>(
+        [this](auto handler, const message<T>& msg)
         {
-          if (!ec)
+          auto completion = wrap_handler<std::error_code>(std::move(handler));
+          if (!m_is_ready)
           {
-            if (m_owner_type == owner::client)
-              read_config();
+            asio::post(m_asio_context, [completion]() { completion(asio::error::not_connected); });
+            return;
           }
-          else
+
+          const auto queued_at = std::chrono::steady_clock::now();
+          if (m_is_in_process)
           {
-            m_socket.close();
+            send_in_process(msg, completion, queued_at);
+            return;
           }
-        }
+
+          submit({ msg, completion, queued_at });
+        },
+        token, msg
       );
     }
 
-    // (ASYNC) Prime context ready to read validation
-    void read_validation(server_interface<T>* server = nullptr)
+    // (ASYNC) Send a message followed by a payload that is never copied into its body, file payloads
+    // are passed to the kernel with sendfile on Linux. The remote end receives one message with the
+    // payload appended to the body. The handler, if any, is called once everything has been written.
+    void send_payload(const message<T>& msg, payload data, std::function<void(std::error_code)> handler = nullptr)
     {
-      asio::async_read(m_socket, asio::buffer(&m_handshake_in, sizeof(uint64_t)),
-        [this, server](std::error_code ec, std::size_t length)
+      const uint64_t total = msg.body.size() + (msg.spooled ? msg.spooled->size() : 0) + data.size();
+      std::error_code ec;
+      if (!m_is_ready)
+        ec = asio::error::not_connected;
+      else if (total > m_remote_config.max_message_size || total > std::numeric_limits<uint32_t>::max())
+        ec = asio::error::message_size;
+
+      if (ec)
+      {
+        if (handler)
+          asio::post(m_asio_context, [handler, ec]() { handler(ec); });
+        return;
+      }
+
+      message<T> copy = msg;
+      copy.header.size = uint32_t(total);
+      unspool(copy, data);
+
+      const auto queued_at = std::chrono::steady_clock::now();
+      if (m_is_in_process)
+      {
+        asio::error_code read_ec;
+        if (append_payload(copy, data, read_ec))
+          send_in_process(copy, handler, queued_at);
+        else if (handler)
+          asio::post(m_asio_context, [handler, read_ec]() { handler(read_ec); });
+        return;
+      }
+
+      submit({ std::move(copy), handler, queued_at, std::move(data) });
+    }
+
+    // Hand the sends held back by coalescing to the context thread now instead of at the end of
+    // the window, see config::coalesce_window. Does nothing if none are held back.
+    void flush()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_coalesce_mutex);
+        if (m_coalesced.empty())
+          return;
+
+        // Submitted under the lock, so batches taken by different threads keep their order
+        for (auto& out : m_coalesced)
+          m_submitted.push(std::move(out));
+        m_coalesced.clear();
+        m_coalesced_bytes = 0;
+      }
+
+      wake_writer();
+    }
+
+    // (ASYNC) Receive the next message of this connection, the completion token is invoked with
+    // void(std::error_code, message<T>). Once used, messages of this connection are delivered here
+    // instead of the owner's incoming queue, so start receiving before the first message can
+    // arrive, e.g. from server_interface::on_client_ready.
+    template<typename CompletionToken>
+    auto receive(CompletionToken&& token)
+    {
+      return asio::async_initiate<CompletionToken, void(std::error_code, message<T>)>(
+        [this](auto handler)
         {
-          if (!ec)
-          {
-            if (m_owner_type == owner::server)
+          auto completion = wrap_handler<std::error_code, message<T>>(std::move(handler));
+          auto self = this->shared_from_this();
+          asio::post(m_asio_context,
+            [this, self, completion]()
             {
-              if (m_handshake_in == m_handshake_check)
+              m_is_receiving = true;
+              if (!m_messages_received.empty())
               {
-                std::cout << "[" << get_id() << "] Client Validated\n";
-                server->on_client_validated(this->shared_from_this());
-                write_config();
-                read_config(server);
+                auto msg = std::move(m_messages_received.front());
+                m_messages_received.pop_front();
+                completion(std::error_code(), std::move(msg));
               }
+              else if (!is_connected())
+                completion(asio::error::not_connected, message<T>());
+              else if (m_receive_handler)
+                completion(asio::error::already_started, message<T>());
               else
-              {
-                std::cout << "[" << get_id() << "] Client Disconnected (Validation Fail)\n";
-                m_socket.close();
-              }
-            }
-            else
-            {
-              m_handshake_out = scramble(m_handshake_in);
-              write_validation();
+                m_receive_handler = completion;
             }
-          }
-          else
-          {
-            std::cout << "[" << get_id() << "] Client Disconnected (read_validation)\n";
-            m_socket.close();
-          }
-        }
+          );
+        },
+        token
       );
     }
 
-    // (ASYNC) Prime context ready to write config
-    void write_config()
+#if defined(ASIO_HAS_CO_AWAIT)
+    // (C++20) Awaitable receive, throws std::system_error when the connection is gone
+    asio::awaitable<message<T>> receive()
+    {
+      co_return co_await receive(asio::use_awaitable);
+    }
+#endif
+
+    // (ASYNC) Send a message as a single UDP datagram, without delivery or ordering guarantees. The
+    // receiver drops a datagram older than the last one it has seen with the same message id, so a
+    // lost or late update never holds up a newer one. Returns false if there is no UDP channel (yet)
+    // or the message does not fit into a datagram.
+    bool send_unreliable(const message<T>& msg)
+    {
+      if (!m_is_udp_ready || !is_valid_id(msg.header) || sizeof(datagram_header) + sizeof(wire_header<T>) + msg.body.size() > max_datagram_size)
+        return false;
+
+      const auto queued_at = std::chrono::steady_clock::now();
+      auto self = this->shared_from_this();
+      asio::post(m_asio_context, [this, self, msg, queued_at]() { write_datagram(msg, queued_at); });
+      return true;
+    }
+
+    // Returns true once datagrams reach the remote, both ends set config::udp and the hello came through
+    bool is_unreliable_ready() const
+    {
+      return m_is_udp_ready;
+    }
+
+    // Identifies the datagrams of this connection, the server draws it at random and passes it over TCP
+    uint64_t get_datagram_key() const
     {
-      asio::async_write(m_socket, asio::buffer(&m_owner_config, sizeof(config)),
-        [this](std::error_code ec, std::size_t length)
+      return m_datagram_key;
+    }
+
+    // (UDP) Called by the server for a datagram that carries this connection's key
+    void receive_datagram(const datagram_header& header, std::vector<uint8_t> data, const asio::ip::udp::endpoint& from)
+    {
+      auto self = this->shared_from_this();
+      asio::post(m_asio_context,
+        [this, self, header, data, from]()
         {
-          if (!ec)
-          {
-            if (m_owner_type == owner::client)
-            {
-              m_is_ready = true;
-              read_header();
-            }
-          }
-          else
-          {
-            std::cout << "[" << get_id() << "] Write Config Fail.\n";
-            m_socket.close();
-          }
+          handle_datagram(header, data.data(), data.size(), from);
         }
       );
     }
 
-    // (ASYNC) Prime context ready to read config
-    void read_config(server_interface<T>* server = nullptr)
+  private:
+    // A message waiting to be written and the handler to call once it has been
+    struct outgoing_message
     {
-      asio::async_read(m_socket, asio::buffer(&m_remote_config, sizeof(config)),
-        [this, server](std::error_code ec, std::size_t length)
-        {
-          if (!ec)
-          {
-            // Check config
-            if (m_remote_config.endian == m_owner_config.endian && m_remote_config.version == m_owner_config.version)
-            {
-              if (m_owner_type == owner::server)
-              {
-                std::cout << "[" << get_id() << "] Client Config Validated\n";
-                server->on_client_config_validated(this->shared_from_this());
-                m_is_ready = true;
-                server->on_client_ready(this->shared_from_this());
-                read_header();
-              }
-              else
-                write_config();
-            }
-            else
-            {
-              if (m_owner_type == owner::server)
-                std::cout << "[" << get_id() << "] Client Disconnected (Config Fail)\n";
-              else
-                std::cout << "[" << get_id() << "] Server Disconnected (Config Fail)\n";
-              m_socket.close();
-            }
-          }
-          else
+      message<T> msg;
+      std::function<void(std::error_code)> handler;
+      std::chrono::steady_clock::time_point queued_at;
+
+      // Written after the body, see send_payload
+      payload data;
+    };
+
+    // Adapts an asio completion handler, which may be move-only, to a std::function
+    // that invokes it through its associated executor
+    template<typename... Args, typename Handler>
+    std::function<void(Args...)> wrap_handler(Handler handler)
+    {
+      auto executor = asio::get_associated_executor(handler, m_asio_context.get_executor());
+      auto shared_handler = std::make_shared<Handler>(std::move(handler));
+      return [executor, shared_handler](Args... args)
+      {
+        auto arguments = std::make_shared<std::tuple<Args...>>(std::move(args)...);
+        asio::dispatch(executor,
+          [shared_handler, arguments]()
           {
-            std::cout << "[" << get_id() << "] Read Config Fail.\n";
-            m_socket.close();
+            apply_handler(*shared_handler, *arguments, std::index_sequence_for<Args...>());
           }
-        }
-      );
+        );
+      };
     }
 
-  protected:
-    // Each connection has a unique socket to a remote
-    asio::ip::tcp::socket m_socket;
+    template<typename Handler, typename Tuple, size_t... Indices>
+    static void apply_handler(Handler& handler, Tuple& arguments, std::index_sequence<Indices...>)
+    {
+      std::move(handler)(std::move(std::get<Indices>(arguments))...);
+    }
 
-    // This context is shared with the whole asio instance
-    asio::io_context& m_asio_context;
+    // (In-process) Hand the message straight to the peer's context, it is complete once posted
+    void send_in_process(const message<T>& msg, std::function<void(std::error_code)> handler, std::chrono::steady_clock::time_point queued_at)
+    {
+      auto peer = m_peer.lock();
+      if (!peer || !m_is_in_process_open)
+      {
+        if (handler)
+          handler(asio::error::not_connected);
+        return;
+      }
 
-    // This queue holds all messages to be sent to the remote side of this connection
-    tsqueue<message<T>> m_messages_out;
+      if (!is_valid_id(msg.header))
+      {
+        reject_message_id(msg.header, handler);
+        return;
+      }
 
-    // This queue holds all messages that have been received from the remote side of this connection
-    tsqueue<owned_message<T>>& m_messages_in;
-    message<T> m_msg_temp_in;
+      m_metrics.message_sent(sizeof(wire_header<T>) + msg.body.size(), std::chrono::steady_clock::now() - queued_at);
 
-    // Owner of this connection
-    owner m_owner_type = owner::server;
+      // Only the peer is captured, its context may outlive this end but not the other way around
+      message<T> copy = msg;
+      asio::post(peer->m_asio_context,
+        [peer, copy]() mutable
+        {
+          if (peer->m_is_in_process_open)
+            peer->handle_incoming(copy);
+        }
+      );
 
-    // Identifier of client
-    uint32_t m_id = 0;
+      if (handler)
+        handler(std::error_code());
+    }
 
-    // Handshake validation
-    uint64_t m_handshake_out = 0;
-    uint64_t m_handshake_in = 0;
-    uint64_t m_handshake_check = 0;
+    // The remote end would drop the connection over an id message_id_traits<T> does not accept
+    void reject_message_id(const message_header<T>& header, const std::function<void(std::error_code)>& handler)
+    {
+      NETRON_LOG_WARNING("[" << get_id() << "] Message Id Not Sendable " << uint64_t(header.id));
+      if (handler)
+        handler(asio::error::invalid_argument);
+    }
 
-    // Client's and server's configuration
-    config_view m_owner_config;
-    config m_remote_config;
+    // Tell an in-process peer once that this end is gone, it closes its end in turn
+    void close_in_process_peer()
+    {
+      if (m_is_in_process && m_is_in_process_open.exchange(false))
+        if (auto peer = m_peer.lock())
+          asio::post(peer->m_asio_context, [peer]() { peer->close_socket(asio::error::eof); });
+    }
+
+    // Hand a message to the context thread, with coalescing it waits for the sends that follow it
+    // within the window or until the batch is big enough
+    void submit(outgoing_message&& out)
+    {
+      m_pending_sends.fetch_add(1, std::memory_order_relaxed);
+      if (m_owner_config.coalesce_window == 0)
+      {
+        m_submitted.push(std::move(out));
+        wake_writer();
+        return;
+      }
+
+      bool is_first = false;
+      bool is_full = false;
+      {
+        std::lock_guard<std::mutex> lock(m_coalesce_mutex);
+        is_first = m_coalesced.empty();
+        m_coalesced_bytes += sizeof(wire_header<T>) + message_size(out);
+        m_coalesced.push_back(std::move(out));
+        is_full = m_coalesced_bytes >= m_owner_config.coalesce_bytes;
+      }
+
+      if (is_full)
+      {
+        flush();
+        return;
+      }
+      if (!is_first)
+        return;
+
+      // The first send of a batch starts its window
+      auto self = this->shared_from_this();
+      asio::post(m_asio_context,
+        [this, self]()
+        {
+          m_coalesce_timer.expires_after(std::chrono::microseconds(m_owner_config.coalesce_window));
+          m_coalesce_timer.async_wait(
+            [this, self](std::error_code ec)
+            {
+              if (!ec)
+                flush();
+            }
+          );
+        }
+      );
+    }
+
+    // Take the sends held back by coalescing
+    std::vector<outgoing_message> take_coalesced()
+    {
+      std::vector<outgoing_message> batch;
+      std::lock_guard<std::mutex> lock(m_coalesce_mutex);
+      batch.swap(m_coalesced);
+      m_coalesced_bytes = 0;
+      m_pending_sends.fetch_sub(batch.size(), std::memory_order_relaxed);
+      return batch;
+    }
+
+    // Make sure the writer looks at the submitted messages. Only the first submission after it
+    // went idle posts to the context, later ones are picked up as each write completes.
+    void wake_writer()
+    {
+      if (m_is_writer_awake.exchange(true))
+        return;
+
+      auto self = this->shared_from_this();
+      asio::post(m_asio_context, [this, self]() { drain_submitted(); });
+    }
+
+    // The writer has nothing left to do, submissions that raced with it going idle wake it again
+    void release_writer()
+    {
+      m_is_writer_awake = false;
+      if (!m_submitted.empty())
+        wake_writer();
+      else if (m_shutdown_handler && is_drained())
+        half_close();
+    }
+
+    // Everything sent has been written, for shared memory the peer has also read it from the ring
+    bool is_drained()
+    {
+      if (!m_messages_out.empty() || !m_submitted.empty())
+        return false;
+#ifdef NETRON_HAS_SHARED_MEMORY
+      if (m_shared_memory)
+        return m_shared_memory->outgoing().readable() == 0;
+#endif
+      return true;
+    }
+
+    // (ASYNC) Wait for a graceful shutdown to finish, dropping what is left at the deadline. The
+    // ring tells its writer nothing, it is polled until the peer has read everything.
+    void wait_for_drain()
+    {
+      auto deadline = m_drain_deadline;
+#ifdef NETRON_HAS_SHARED_MEMORY
+      if (m_shared_memory)
+      {
+        if (is_drained())
+          half_close();
+        deadline = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(1));
+      }
+#endif
+
+      auto self = this->shared_from_this();
+      m_drain_timer.expires_at(deadline);
+      m_drain_timer.async_wait(
+        [this, self](std::error_code ec)
+        {
+          if (ec || !m_shutdown_handler)
+            return;
+
+          if (std::chrono::steady_clock::now() < m_drain_deadline)
+          {
+            wait_for_drain();
+            return;
+          }
+
+          // Messages still submitted go to the write chain, which fails them once the socket is closed
+          const bool is_idle = m_messages_out.empty();
+          if (take_submitted())
+            start_writing(is_idle);
+
+          NETRON_LOG_WARNING("[" << get_id() << "] Shutdown Timed Out.");
+          close_socket(asio::error::timed_out);
+        }
+      );
+    }
+
+    // Everything has been written, the remote learns that nothing more follows and closes its end
+    void half_close()
+    {
+      if (m_is_half_closed)
+        return;
+
+      m_is_half_closed = true;
+      asio::error_code ec;
+      m_socket.shutdown(stream_protocol::socket::shutdown_send, ec);
+      if (ec)
+        close_socket(ec);
+    }
+
+    // Move the submitted messages to the outgoing queue on the context thread, returns true if any
+    // was queued
+    bool take_submitted()
+    {
+      bool is_queued = false;
+      outgoing_message out;
+      while (m_submitted.pop(out))
+      {
+        is_queued = push_message(std::move(out)) || is_queued;
+        m_pending_sends.fetch_sub(1, std::memory_order_relaxed);
+      }
+      return is_queued;
+    }
+
+    // Queue the submitted messages on the context thread, starting the write chain if it is idle
+    void drain_submitted()
+    {
+      const bool is_idle = m_messages_out.empty();
+      if (take_submitted())
+        start_writing(is_idle);
+
+      // A running socket write chain keeps the writer awake until it runs dry, the ring is written
+      // to right away
+      bool is_writing = !m_messages_out.empty();
+#ifdef NETRON_HAS_SHARED_MEMORY
+      is_writing = is_writing && !m_shared_memory;
+#endif
+      if (!is_writing)
+        release_writer();
+    }
+
+    // A write has completed, carry on with the queue and whatever was submitted meanwhile
+    void continue_writing()
+    {
+      take_submitted();
+      if (!m_messages_out.empty())
+        write_messages();
+      else
+        release_writer();
+    }
+
+    // Validate a message and add it to the outgoing queue, returns false if it was rejected
+    bool push_message(outgoing_message&& out)
+    {
+      if (!is_valid_id(out.msg.header))
+      {
+        reject_message_id(out.msg.header, out.handler);
+        return false;
+      }
+
+      // Nothing can be written after a half-close
+      if (m_is_half_closed)
+      {
+        m_shutdown_dropped++;
+        if (out.handler)
+          out.handler(asio::error::shut_down);
+        return false;
+      }
+
+      unspool(out.msg, out.data);
+
+#ifdef NETRON_HAS_SHARED_MEMORY
+      if (m_shared_memory)
+      {
+        // The ring holds whole messages, a payload is copied in with the body
+        asio::error_code ec;
+        if (!out.data.empty() && !append_payload(out.msg, out.data, ec))
+        {
+          if (out.handler)
+            out.handler(ec);
+          return false;
+        }
+        out.data = payload();
+      }
+#endif
+
+      m_messages_out.push_back(std::move(out));
+      return true;
+    }
+
+    // Messages have been queued, the write chain is started unless it was already running
+    void start_writing(bool is_idle)
+    {
+#ifdef NETRON_HAS_SHARED_MEMORY
+      if (m_shared_memory)
+      {
+        if (m_shared_memory_wait)
+          write_shared_memory();
+        else
+          fail_messages(asio::error::not_connected);
+        return;
+      }
+#endif
+
+      if (is_idle)
+        write_messages();
+    }
+
+    // The front message has been written
+    void finish_message()
+    {
+      auto out = m_messages_out.pop_front();
+      m_metrics.message_sent(sizeof(wire_header<T>) + out.msg.body.size() + out.data.size(), std::chrono::steady_clock::now() - out.queued_at);
+      if (out.handler)
+        out.handler(std::error_code());
+    }
+
+    // Append a payload to the body, for transports without a socket to hand it to
+    static bool append_payload(message<T>& msg, const payload& data, asio::error_code& ec)
+    {
+      const size_t offset = msg.body.size();
+      msg.body.resize(offset + size_t(data.size()));
+      return data.read(0, msg.body.data() + offset, size_t(data.size()), ec) == data.size();
+    }
+
+    // A received spooled body is sent on from its mapping like a memory payload, or copied in
+    // front of a payload that is set already
+    static void unspool(message<T>& msg, payload& data)
+    {
+      if (!msg.spooled)
+        return;
+
+      if (data.empty())
+        data = payload::from_memory(msg.spooled, msg.spooled->data(), msg.spooled->size());
+      else
+        msg.body.insert(msg.body.end(), msg.spooled->data(), msg.spooled->data() + msg.spooled->size());
+      msg.spooled.reset();
+    }
+
+    // Body and payload bytes of a queued message
+    static uint64_t message_size(const outgoing_message& out)
+    {
+      return out.msg.body.size() + out.data.size();
+    }
+
+    // A write has failed, nothing queued will be sent anymore
+    void fail_messages(std::error_code ec)
+    {
+      while (!m_messages_out.empty())
+      {
+        auto out = m_messages_out.pop_front();
+        if (m_shutdown_handler)
+          m_shutdown_dropped++;
+        if (out.handler)
+          out.handler(ec);
+      }
+    }
+
+    // Close the socket, a client side owner is told why the connection ended
+    void close_socket(std::error_code reason)
+    {
+      close_in_process_peer();
+
+      if (!m_is_ready && m_socket.is_open() && reason != asio::error::operation_aborted)
+        m_metrics.handshake_failed();
+
+      asio::error_code ec;
+      m_socket.close(ec);
+      m_handshake_timer.cancel();
+      m_read_timer.cancel();
+      m_drain_timer.cancel();
+
+      // Sends still held back by coalescing are never handed over
+      m_coalesce_timer.cancel();
+      for (auto& out : take_coalesced())
+        if (out.handler)
+          out.handler(reason);
+
+      // The server's UDP socket is shared with its other connections
+      m_is_udp_ready = false;
+      m_udp_timer.cancel();
+      if (m_udp_channel && m_owner_type == owner::client)
+        m_udp_channel->close();
+      m_udp_channel.reset();
+
+#ifdef NETRON_HAS_SHARED_MEMORY
+      // Messages waiting for room in the ring are lost with it
+      if (m_shared_memory_wait)
+      {
+        m_shared_memory_wait.reset();
+        fail_messages(reason);
+      }
+#endif
+
+      if (m_receive_handler)
+      {
+        std::function<void(std::error_code, message<T>)> receive_handler;
+        receive_handler.swap(m_receive_handler);
+        receive_handler(reason, message<T>());
+      }
+
+      // A graceful shutdown is over, messages left in the write chain are failed once it notices
+      if (m_shutdown_handler)
+      {
+        std::function<void(size_t)> shutdown_handler;
+        shutdown_handler.swap(m_shutdown_handler);
+        shutdown_handler(m_shutdown_dropped + m_messages_out.count());
+      }
+
+      // Every handler is called at most once, later failures of pending operations are ignored
+      std::function<void(std::error_code)> handler;
+      if (m_is_ready)
+        handler.swap(m_disconnect_handler);
+      else
+        handler.swap(m_connect_handler);
+
+      if (handler)
+        handler(reason);
+    }
+
+    // Apply the socket options of the owner's configuration, unsupported options are ignored
+    void apply_socket_options()
+    {
+      asio::error_code ec;
+      const auto endpoint = m_socket.local_endpoint(ec);
+      m_is_tcp = is_tcp(endpoint);
+      m_is_local = is_local(endpoint);
+      if (m_is_tcp)
+      {
+        m_socket.set_option(asio::ip::tcp::no_delay(m_owner_config.tcp_no_delay), ec);
+        m_socket.set_option(asio::socket_base::keep_alive(m_owner_config.keep_alive), ec);
+      }
+
+      if (m_owner_config.send_buffer_size > 0)
+        m_socket.set_option(asio::socket_base::send_buffer_size(m_owner_config.send_buffer_size), ec);
+
+      if (m_owner_config.receive_buffer_size > 0)
+        m_socket.set_option(asio::socket_base::receive_buffer_size(m_owner_config.receive_buffer_size), ec);
+
+      enable_quick_ack();
+    }
+
+    // The kernel falls back to delayed ACKs on its own, so quick ACK is re-enabled after every read
+    void enable_quick_ack()
+    {
+#ifdef TCP_QUICKACK
+      if (m_owner_config.tcp_quick_ack && m_is_tcp)
+      {
+        asio::error_code ec;
+        m_socket.set_option(asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>(true), ec);
+      }
+#endif
+    }
+
+    // (ASYNC) Drop the connection if the handshake does not finish in time
+    void start_handshake_timer()
+    {
+      if (m_owner_config.handshake_timeout == 0)
+        return;
+
+      m_handshake_timer.expires_after(std::chrono::milliseconds(m_owner_config.handshake_timeout));
+      auto self = this->shared_from_this();
+      m_handshake_timer.async_wait(
+        [this, self](std::error_code ec)
+        {
+          if (!ec)
+          {
+            NETRON_LOG_WARNING("[" << get_id() << "] Handshake Timeout");
+            close_socket(asio::error::timed_out);
+          }
+        }
+      );
+    }
+
+    // Leave the handshake stage, every pending handshake ends here exactly once
+    void end_handshake(server_interface<T>* server)
+    {
+      m_handshake_timer.cancel();
+      server->release_pending_connection();
+    }
+
+    // (ASYNC) Prime context ready to write the queued messages, the headers and bodies of up to
+    // max_write_batch of them go out with a single gather write. Memory payloads are written from
+    // where they are, a file payload ends the batch and follows it on its own.
+    void write_messages()
+    {
+      if (message_size(m_messages_out.front()) > m_remote_config.max_message_size)
+        throw std::runtime_error("Message size exceeds maximum message size");
+
+      m_write_buffers.clear();
+      const size_t count = std::min(m_messages_out.count(), max_write_batch);
+      const bool has_checksum = uses_checksum();
+      m_write_headers.resize(count);
+      m_write_checksums.resize(count);
+      size_t batched = 0;
+      bool has_file_payload = false;
+      while (batched < count && !has_file_payload)
+      {
+        // An oversized message is left at the front for the next write to report
+        const auto& out = m_messages_out.at(batched);
+        if (batched > 0 && message_size(out) > m_remote_config.max_message_size)
+          break;
+
+        m_write_headers[batched] = to_wire(out.msg.header);
+        m_write_buffers.push_back(asio::buffer(&m_write_headers[batched], sizeof(wire_header<T>)));
+        if (!out.msg.body.empty())
+          m_write_buffers.push_back(asio::buffer(out.msg.body.data(), out.msg.body.size()));
+        if (!out.data.empty() && !out.data.is_file())
+          m_write_buffers.push_back(out.data.buffer());
+
+        has_file_payload = out.data.is_file() && !out.data.empty();
+        if (has_checksum)
+        {
+          uint32_t crc = crc32c(0, &m_write_headers[batched], sizeof(wire_header<T>));
+          crc = crc32c(crc, out.msg.body.data(), out.msg.body.size());
+          if (!out.data.is_file())
+            crc = crc32c(crc, out.data.buffer().data(), out.data.buffer().size());
+
+          // A file payload is checksummed while it is copied, its checksum follows it
+          m_write_checksums[batched] = crc;
+          if (!has_file_payload)
+            m_write_buffers.push_back(asio::buffer(&m_write_checksums[batched], sizeof(uint32_t)));
+        }
+        ++batched;
+      }
+
+      auto self = this->shared_from_this();
+      asio::async_write(m_socket, m_write_buffers,
+        [this, self, batched, has_file_payload](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            for (size_t i = has_file_payload ? 1 : 0; i < batched; ++i)
+              finish_message();
+
+            if (has_file_payload)
+            {
+              m_payload_checksum = m_write_checksums[batched - 1];
+              write_file_payload(0);
+            }
+            else
+            {
+              continue_writing();
+            }
+          }
+          else
+          {
+            abort_writing(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Write the file payload of the front message from sent bytes on, its header and body
+    // are out already
+    void write_file_payload(uint64_t sent)
+    {
+      // The socket may have been closed while the next chunk was waiting its turn
+      if (!m_socket.is_open())
+      {
+        abort_writing(asio::error::not_connected);
+        return;
+      }
+
+#if defined(__linux__)
+      // The kernel's copy never passes through here to be checksummed
+      if (uses_checksum())
+      {
+        copy_file_payload(sent);
+        return;
+      }
+
+      const payload& data = m_messages_out.front().data;
+      asio::error_code ec;
+      m_socket.native_non_blocking(true, ec);
+      if (!ec)
+        sent += data.send_file(m_socket.native_handle(), sent, std::min(data.size() - sent, max_file_write), ec);
+
+      if (sent == data.size())
+      {
+        finish_payload();
+        return;
+      }
+
+      auto self = this->shared_from_this();
+      if (!ec)
+      {
+        asio::post(m_asio_context, [this, self, sent]() { write_file_payload(sent); });
+      }
+      else if (ec == asio::error::would_block || ec == asio::error::try_again)
+      {
+        m_socket.async_wait(asio::socket_base::wait_write,
+          [this, self, sent](std::error_code ec)
+          {
+            if (!ec)
+              write_file_payload(sent);
+            else
+              abort_writing(ec);
+          }
+        );
+      }
+      else if (ec == asio::error::invalid_argument || ec == asio::error::operation_not_supported)
+      {
+        // Files sendfile cannot map, such as pipes
+        copy_file_payload(sent);
+      }
+      else
+      {
+        abort_writing(ec);
+      }
+#else
+      copy_file_payload(sent);
+#endif
+    }
+
+    // (ASYNC) Write the file payload of the front message through a bounded buffer
+    void copy_file_payload(uint64_t sent)
+    {
+      const payload& data = m_messages_out.front().data;
+      if (sent == data.size())
+      {
+        if (uses_checksum())
+          write_payload_checksum();
+        else
+          finish_payload();
+        return;
+      }
+
+      asio::error_code ec;
+      m_file_buffer.resize(size_t(std::min<uint64_t>(data.size() - sent, file_copy_chunk)));
+      data.read(sent, m_file_buffer.data(), m_file_buffer.size(), ec);
+      if (ec)
+      {
+        abort_writing(ec);
+        return;
+      }
+
+      if (uses_checksum())
+        m_payload_checksum = crc32c(m_payload_checksum, m_file_buffer.data(), m_file_buffer.size());
+
+      auto self = this->shared_from_this();
+      asio::async_write(m_socket, asio::buffer(m_file_buffer),
+        [this, self, sent](std::error_code ec, std::size_t length)
+        {
+          if (!ec && m_socket.is_open())
+            copy_file_payload(sent + length);
+          else
+            abort_writing(ec ? ec : asio::error::not_connected);
+        }
+      );
+    }
+
+    // (ASYNC) Write the checksum that follows the file payload of the front message
+    void write_payload_checksum()
+    {
+      auto self = this->shared_from_this();
+      asio::async_write(m_socket, asio::buffer(&m_payload_checksum, sizeof(uint32_t)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec && m_socket.is_open())
+            finish_payload();
+          else
+            abort_writing(ec ? ec : asio::error::not_connected);
+        }
+      );
+    }
+
+    // Both ends asked for checksums on the socket, see config::checksum
+    bool uses_checksum() const
+    {
+      return m_owner_config.checksum && m_remote_config.checksum;
+    }
+
+    // The payload of the front message has been written, carry on with the queue
+    void finish_payload()
+    {
+      finish_message();
+      continue_writing();
+    }
+
+    // Writing has failed, the connection is closed with everything still queued
+    void abort_writing(std::error_code ec)
+    {
+      NETRON_LOG_INFO("[" << get_id() << "] Write Messages Fail.");
+      fail_messages(ec);
+      close_socket(ec);
+      release_writer();
+    }
+
+    // (ASYNC) Prime context ready to read a message header
+    void read_header()
+    {
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, asio::buffer(&m_header_in, sizeof(wire_header<T>)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec && !from_wire(m_header_in, m_msg_temp_in.header))
+          {
+            NETRON_LOG_WARNING("[" << get_id() << "] Invalid Message Id " << uint64_t(m_header_in.id));
+            close_socket(std::make_error_code(std::errc::bad_message));
+          }
+          else if (!ec && m_msg_temp_in.header.size <= m_owner_config.max_message_size)
+          {
+            enable_quick_ack();
+
+            if (should_spool(m_msg_temp_in.header.size))
+            {
+              m_spooled_in = std::make_shared<spooled_body>();
+              asio::error_code spool_ec;
+              if (!m_spooled_in->open(m_msg_temp_in.header.size, spool_ec))
+              {
+                NETRON_LOG_ERROR("[" << get_id() << "] Spooling Fail: " << spool_ec.message());
+                close_socket(spool_ec);
+                return;
+              }
+
+              m_msg_temp_in.body.clear();
+              read_body(m_spooled_in->buffer());
+            }
+            else if (m_msg_temp_in.header.size > 0)
+            {
+              m_msg_temp_in.body.resize(m_msg_temp_in.header.size);
+              read_body(asio::buffer(m_msg_temp_in.body.data(), m_msg_temp_in.body.size()));
+            }
+            else
+            {
+              // The body of the previous message must not be passed on with this one
+              m_msg_temp_in.body.clear();
+              read_checksum();
+            }
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Read Header Fail.");
+            close_socket(ec ? ec : asio::error::message_size);
+          }
+        }
+      );
+    }
+
+    // Bodies this large are received into a memory-mapped temporary file
+    bool should_spool(uint64_t size) const
+    {
+#ifdef NETRON_HAS_SPOOLING
+      return m_owner_config.spool_threshold > 0 && size >= m_owner_config.spool_threshold;
+#else
+      return false;
+#endif
+    }
+
+    // (ASYNC) Prime context ready to read a message body into the body vector or its spool
+    void read_body(asio::mutable_buffer buffer)
+    {
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, buffer,
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            enable_quick_ack();
+            if (m_spooled_in)
+            {
+              m_spooled_in->seal();
+              m_msg_temp_in.spooled = std::move(m_spooled_in);
+            }
+            read_checksum();
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Read Body Fail.");
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Read and verify the checksum that follows a message when checksums are in use
+    void read_checksum()
+    {
+      if (!uses_checksum())
+      {
+        add_to_incoming_message_queue();
+        return;
+      }
+
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, asio::buffer(&m_checksum_in, sizeof(uint32_t)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (ec)
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Read Checksum Fail.");
+            close_socket(ec);
+            return;
+          }
+
+          const auto& msg = m_msg_temp_in;
+          uint32_t crc = crc32c(0, &m_header_in, sizeof(wire_header<T>));
+          if (msg.spooled)
+            crc = crc32c(crc, msg.spooled->data(), msg.spooled->size());
+          else
+            crc = crc32c(crc, msg.body.data(), msg.body.size());
+
+          if (crc != m_checksum_in)
+          {
+            NETRON_LOG_ERROR("[" << get_id() << "] Checksum Mismatch.");
+            m_metrics.checksum_failed();
+            close_socket(std::make_error_code(std::errc::bad_message));
+            return;
+          }
+
+          add_to_incoming_message_queue();
+        }
+      );
+    }
+
+    // Add incoming message to queue
+    void add_to_incoming_message_queue()
+    {
+      m_message_bucket.take(1.0);
+      m_byte_bucket.take(double(sizeof(wire_header<T>) + m_msg_temp_in.header.size));
+      handle_incoming(m_msg_temp_in);
+
+      // The mapping lives on with the copies handed out only
+      m_msg_temp_in.spooled.reset();
+      read_next_message();
+    }
+
+    // (ASYNC) Read the next message once the remote is back within its rate limits, the socket
+    // is left alone meanwhile, see config::max_message_rate
+    void read_next_message()
+    {
+      const auto delay = std::max(m_message_bucket.wait_time(1.0), m_byte_bucket.wait_time(0.0));
+      if (delay.count() == 0)
+      {
+        read_header();
+        return;
+      }
+
+      m_metrics.rate_limited();
+      auto self = this->shared_from_this();
+      m_read_timer.expires_after(delay);
+      m_read_timer.async_wait(
+        [this, self](std::error_code ec)
+        {
+          if (!ec && m_socket.is_open())
+            read_header();
+        }
+      );
+    }
+
+    // Pass a complete message on to whoever waits for it
+    void handle_incoming(message<T>& msg)
+    {
+      m_metrics.message_received(sizeof(wire_header<T>) + msg.body.size());
+
+      if (msg.header.is_reply && msg.header.correlation_id != 0 && m_reply_handler)
+        m_reply_handler(msg);
+      else if (m_is_receiving)
+        deliver_received_message(msg);
+      else
+        m_messages_in.push_back({ this->shared_from_this(), msg });
+    }
+
+    // Hand the message to a waiting receive or keep it until the next one
+    void deliver_received_message(message<T>& msg)
+    {
+      if (m_receive_handler)
+      {
+        std::function<void(std::error_code, message<T>)> receive_handler;
+        receive_handler.swap(m_receive_handler);
+        receive_handler(std::error_code(), msg);
+      }
+      else
+      {
+        m_messages_received.push_back(msg);
+      }
+    }
+
+    // Naive implementation. It only protects against accidental connections.
+    uint64_t scramble(uint64_t value)
+    {
+      uint64_t out = value ^ 0xCF2911F740C52729;
+      out = (out & 0xF0F0F0F0F0F0F0) >> 4 | (out & 0x0F0F0F0F0F0F0F) << 4;
+      return out ^ 0xAF1163442D8647C0;
+    }
+
+    // (ASYNC) Prime context ready to write validation
+    void write_validation()
+    {
+      auto self = this->shared_from_this();
+      asio::async_write(m_socket, asio::buffer(&m_handshake_out, sizeof(uint64_t)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            if (m_owner_type == owner::client)
+              read_config();
+          }
+          else
+          {
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Prime context ready to read validation
+    void read_validation(server_interface<T>* server = nullptr)
+    {
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, asio::buffer(&m_handshake_in, sizeof(uint64_t)),
+        [this, self, server](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            if (m_owner_type == owner::server)
+            {
+              if (m_handshake_in == m_handshake_check)
+              {
+                NETRON_LOG_INFO("[" << get_id() << "] Client Validated");
+                server->on_client_validated(this->shared_from_this());
+                write_config();
+                read_config(server);
+              }
+              else
+              {
+                NETRON_LOG_WARNING("[" << get_id() << "] Client Disconnected (Validation Fail)");
+                end_handshake(server);
+                close_socket(asio::error::access_denied);
+              }
+            }
+            else
+            {
+              m_handshake_out = scramble(m_handshake_in);
+              write_validation();
+            }
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Client Disconnected (read_validation)");
+            if (m_owner_type == owner::server)
+              end_handshake(server);
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Prime context ready to write config
+    void write_config()
+    {
+      auto self = this->shared_from_this();
+      m_config_out = to_wire_config(m_owner_config);
+      asio::async_write(m_socket, asio::buffer(&m_config_out, sizeof(wire_config)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            if (m_owner_type == owner::client)
+            {
+              if (uses_shared_memory())
+                receive_shared_memory();
+              else if (uses_udp())
+                receive_datagram_key();
+              else
+                finish_client_handshake();
+            }
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Write Config Fail.");
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Prime context ready to read config. The endian, version and format come first, the
+    // rest is only read from a peer that sends the same layout.
+    void read_config(server_interface<T>* server = nullptr)
+    {
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, asio::buffer(&m_remote_config, offsetof(wire_config, max_message_size)),
+        [this, self, server](std::error_code ec, std::size_t length)
+        {
+          if (!ec && !is_remote_version_compatible())
+          {
+            reject_config(server);
+          }
+          else if (!ec)
+          {
+            read_config_fields(server);
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Read Config Fail.");
+            if (m_owner_type == owner::server)
+              end_handshake(server);
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Read the negotiated fields that follow the layout's prefix
+    void read_config_fields(server_interface<T>* server)
+    {
+      const size_t prefix = offsetof(wire_config, max_message_size);
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, asio::buffer(reinterpret_cast<uint8_t*>(&m_remote_config) + prefix, sizeof(wire_config) - prefix),
+        [this, self, server](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            // Check config
+            if (is_remote_config_compatible())
+            {
+              if (m_owner_type == owner::server)
+              {
+                NETRON_LOG_INFO("[" << get_id() << "] Client Config Validated");
+                if (uses_shared_memory())
+                  offer_shared_memory(server);
+                else if (uses_udp())
+                  send_datagram_key(server);
+                else
+                  finish_server_handshake(server);
+              }
+              else
+                write_config();
+            }
+            else
+            {
+              reject_config(server);
+            }
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Read Config Fail.");
+            if (m_owner_type == owner::server)
+              end_handshake(server);
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // The owner's config as it is exchanged, with the wire header this connection frames messages with
+    static wire_config to_wire_config(const config& cfg)
+    {
+      wire_config wire;
+      wire.endian = cfg.endian;
+      wire.version = cfg.version;
+      wire.max_message_size = cfg.max_message_size;
+      wire.wire_header_size = uint8_t(sizeof(wire_header<T>));
+      wire.message_ids_hash = message_id_traits<T>::ids_hash;
+      wire.checksum = cfg.checksum;
+      wire.udp = cfg.udp;
+      wire.shared_memory = cfg.shared_memory;
+      wire.shared_memory_size = cfg.shared_memory_size;
+      return wire;
+    }
+
+    // Both ends speak the same protocol version in the same byte order and exchange the same layout
+    bool is_remote_version_compatible() const
+    {
+      return m_remote_config.endian == m_owner_config.endian && m_remote_config.version == m_owner_config.version &&
+        m_remote_config.format == wire_config_format;
+    }
+
+    // ...and frame messages alike
+    bool is_remote_config_compatible() const
+    {
+      return is_remote_version_compatible() && m_remote_config.wire_header_size == sizeof(wire_header<T>) &&
+        m_remote_config.message_ids_hash == message_id_traits<T>::ids_hash;
+    }
+
+    // The remote's config does not match, the handshake ends here
+    void reject_config(server_interface<T>* server)
+    {
+      if (m_owner_type == owner::server)
+      {
+        NETRON_LOG_WARNING("[" << get_id() << "] Client Disconnected (Config Fail)");
+        end_handshake(server);
+      }
+      else
+        NETRON_LOG_WARNING("[" << get_id() << "] Server Disconnected (Config Fail)");
+      close_socket(std::make_error_code(std::errc::protocol_not_supported));
+    }
+
+    // The client is ready once it has sent its config, or received the shared memory
+    void finish_client_handshake()
+    {
+      m_handshake_timer.cancel();
+      if (uses_udp())
+        open_udp_channel();
+      m_is_ready = true;
+
+      std::function<void(std::error_code)> handler;
+      handler.swap(m_connect_handler);
+      if (handler)
+        handler(std::error_code());
+
+      start_reading();
+    }
+
+    // The server is ready once it has validated the client's config, or sent the shared memory
+    void finish_server_handshake(server_interface<T>* server)
+    {
+      end_handshake(server);
+      if (uses_udp())
+        m_udp_channel = server->register_datagram_connection(this->shared_from_this());
+      server->on_client_config_validated(this->shared_from_this());
+      m_is_ready = true;
+      server->on_client_ready(this->shared_from_this());
+      start_reading();
+    }
+
+    void start_reading()
+    {
+#ifdef NETRON_HAS_SHARED_MEMORY
+      if (m_shared_memory)
+      {
+        start_shared_memory();
+        return;
+      }
+#endif
+      read_header();
+    }
+
+    // Both ends of a TCP connection asked for a UDP channel
+    bool uses_udp() const
+    {
+      return m_is_tcp && m_owner_config.udp && m_remote_config.udp;
+    }
+
+    // (ASYNC) Draw the key of this connection's datagrams and pass it to the client, part of the
+    // server's handshake. Only the TCP peer learns it, datagrams without it are dropped.
+    void send_datagram_key(server_interface<T>* server)
+    {
+      thread_local std::mt19937_64 random(std::random_device{}());
+      m_datagram_key = random();
+
+      // Datagrams are only taken from the TCP peer's address, the port is learnt from its hello
+      asio::error_code ec;
+      m_udp_remote = asio::ip::udp::endpoint(to_tcp(m_socket.remote_endpoint(ec)).address(), 0);
+
+      auto self = this->shared_from_this();
+      asio::async_write(m_socket, asio::buffer(&m_datagram_key, sizeof(uint64_t)),
+        [this, self, server](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            finish_server_handshake(server);
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Write Datagram Key Fail.");
+            end_handshake(server);
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // (ASYNC) Take the key the server passes right after the configs, part of the client's handshake
+    void receive_datagram_key()
+    {
+      auto self = this->shared_from_this();
+      asio::async_read(m_socket, asio::buffer(&m_datagram_key, sizeof(uint64_t)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+          {
+            finish_client_handshake();
+          }
+          else
+          {
+            NETRON_LOG_INFO("[" << get_id() << "] Read Datagram Key Fail.");
+            close_socket(ec);
+          }
+        }
+      );
+    }
+
+    // Open the client's UDP socket and greet the server, which learns the client's address from it
+    void open_udp_channel()
+    {
+      asio::error_code ec;
+      const auto remote = to_tcp(m_socket.remote_endpoint(ec));
+      m_udp_remote = asio::ip::udp::endpoint(remote.address(), remote.port());
+
+      try
+      {
+        m_udp_channel = std::make_shared<udp_channel>(m_asio_context,
+          asio::ip::udp::endpoint(remote.address().is_v4() ? asio::ip::udp::v4() : asio::ip::udp::v6(), 0));
+      }
+      catch (std::exception& e)
+      {
+        NETRON_LOG_WARNING("[" << get_id() << "] UDP Channel Fail: " << e.what());
+        return;
+      }
+
+      std::weak_ptr<connection<T>> weak_self = this->shared_from_this();
+      m_udp_channel->start_receiving(
+        [weak_self](const datagram_header& header, const uint8_t* data, size_t size, const asio::ip::udp::endpoint& from)
+        {
+          if (auto self = weak_self.lock())
+            self->handle_datagram(header, data, size, from);
+        }
+      );
+
+      send_datagram_hello(0);
+    }
+
+    // The client repeats its hello until the server's answer arrives, a datagram may get lost
+    void send_datagram_hello(uint32_t attempt)
+    {
+      datagram_header hello;
+      hello.key = get_datagram_key();
+      m_udp_channel->send_to(m_udp_remote, asio::buffer(&hello, sizeof(hello)));
+
+      if (m_owner_type == owner::client && attempt < 50)
+      {
+        auto self = this->shared_from_this();
+        m_udp_timer.expires_after(std::chrono::milliseconds(100));
+        m_udp_timer.async_wait(
+          [this, self, attempt](std::error_code ec)
+          {
+            if (!ec && m_udp_channel && !m_is_udp_ready)
+              send_datagram_hello(attempt + 1);
+          }
+        );
+      }
+    }
+
+    void write_datagram(const message<T>& msg, std::chrono::steady_clock::time_point queued_at)
+    {
+      if (!m_udp_channel)
+        return;
+
+      // 0 is reserved for the hello
+      if (++m_udp_sequence == 0)
+        ++m_udp_sequence;
+
+      datagram_header datagram;
+      datagram.key = get_datagram_key();
+      datagram.sequence = m_udp_sequence;
+
+      wire_header<T> header = to_wire(msg.header);
+      header.size = uint32_t(msg.body.size());
+
+      const std::array<asio::const_buffer, 3> buffers = {
+        asio::buffer(&datagram, sizeof(datagram)),
+        asio::buffer(&header, sizeof(header)),
+        asio::buffer(msg.body.data(), msg.body.size())
+      };
+
+      if (m_udp_channel->send_to(m_udp_remote, buffers))
+        m_metrics.message_sent(sizeof(wire_header<T>) + msg.body.size(), std::chrono::steady_clock::now() - queued_at);
+    }
+
+    // A datagram arrived on the context thread, stale and malformed ones are dropped
+    void handle_datagram(const datagram_header& datagram, const uint8_t* data, size_t size, const asio::ip::udp::endpoint& from)
+    {
+      if (!m_udp_channel || datagram.key != get_datagram_key() || from.address() != m_udp_remote.address())
+        return;
+
+      // The server sends to whichever port the client's datagrams come from, a NAT may change it
+      if (m_owner_type == owner::server)
+        m_udp_remote = from;
+
+      if (!m_is_udp_ready)
+      {
+        m_is_udp_ready = true;
+        m_udp_timer.cancel();
+      }
+
+      if (datagram.sequence == 0)
+      {
+        if (m_owner_type == owner::server)
+          send_datagram_hello(0);
+        return;
+      }
+
+      wire_header<T> wire;
+      message_header<T> header;
+      if (size < sizeof(wire))
+        return;
+      std::memcpy(&wire, data, sizeof(wire));
+      if (!from_wire(wire, header) || header.size != size - sizeof(wire) || header.size > m_owner_config.max_message_size)
+        return;
+
+      // Latest wins, sequence numbers are compared with wrap-around
+      auto it = m_udp_sequences.find(header.id);
+      if (it != m_udp_sequences.end() && int32_t(datagram.sequence - it->second) <= 0)
+        return;
+      m_udp_sequences[header.id] = datagram.sequence;
+
+      // Datagrams count against the rate limits like messages read from the socket, over them they
+      // are dropped instead of waited for
+      if (m_message_bucket.wait_time(1.0).count() > 0 || m_byte_bucket.wait_time(0.0).count() > 0)
+      {
+        m_metrics.rate_limit_dropped();
+        return;
+      }
+      m_message_bucket.take(1.0);
+      m_byte_bucket.take(double(size));
+
+      message<T> msg;
+      msg.header = header;
+      msg.body.assign(data + sizeof(wire), data + size);
+      handle_incoming(msg);
+    }
+
+    // Both ends of a Unix domain socket asked for shared memory, they decide the same way
+    bool uses_shared_memory() const
+    {
+#ifdef NETRON_HAS_SHARED_MEMORY
+      return m_is_local && m_owner_config.shared_memory && m_remote_config.shared_memory;
+#else
+      return false;
+#endif
+    }
+
+#ifdef NETRON_HAS_SHARED_MEMORY
+    // (ASYNC) Create the rings and pass them to the client, part of the server's handshake
+    void offer_shared_memory(server_interface<T>* server)
+    {
+      asio::error_code ec;
+      auto channel = std::make_unique<shared_memory_channel>(true);
+      if (!channel->create(m_owner_config.shared_memory_size, ec))
+      {
+        NETRON_LOG_WARNING("[" << get_id() << "] Client Disconnected (Shared Memory Fail: " << ec.message() << ")");
+        end_handshake(server);
+        close_socket(ec);
+        return;
+      }
+
+      m_shared_memory = std::move(channel);
+      send_shared_memory(server);
+    }
+
+    void send_shared_memory(server_interface<T>* server)
+    {
+      asio::error_code ec;
+      if (m_shared_memory->send_descriptors(m_socket.native_handle(), ec))
+      {
+        finish_server_handshake(server);
+        return;
+      }
+
+      if (ec == asio::error::would_block)
+      {
+        auto self = this->shared_from_this();
+        m_socket.async_wait(stream_protocol::socket::wait_write,
+          [this, self, server](std::error_code ec)
+          {
+            if (!ec)
+            {
+              send_shared_memory(server);
+            }
+            else
+            {
+              end_handshake(server);
+              close_socket(ec);
+            }
+          }
+        );
+        return;
+      }
+
+      NETRON_LOG_WARNING("[" << get_id() << "] Client Disconnected (Shared Memory Fail: " << ec.message() << ")");
+      end_handshake(server);
+      close_socket(ec);
+    }
+
+    // (ASYNC) Take the rings the server passes right after the configs, part of the client's handshake
+    void receive_shared_memory()
+    {
+      auto self = this->shared_from_this();
+      m_socket.async_wait(stream_protocol::socket::wait_read,
+        [this, self](std::error_code ec)
+        {
+          if (!ec)
+          {
+            auto channel = std::make_unique<shared_memory_channel>(false);
+            asio::error_code receive_ec;
+            if (channel->receive_descriptors(m_socket.native_handle(), receive_ec))
+            {
+              m_shared_memory = std::move(channel);
+              finish_client_handshake();
+              return;
+            }
+
+            if (receive_ec == asio::error::would_block)
+            {
+              receive_shared_memory();
+              return;
+            }
+            ec = receive_ec;
+          }
+
+          NETRON_LOG_WARNING("[" << get_id() << "] Server Disconnected (Shared Memory Fail: " << ec.message() << ")");
+          close_socket(ec);
+        }
+      );
+    }
+
+    // Messages go through the rings from now on, the socket only tells when the peer is gone
+    void start_shared_memory()
+    {
+      m_shared_memory_wait = std::make_unique<asio::posix::stream_descriptor>(m_asio_context, m_shared_memory->release_wait_handle());
+
+      auto self = this->shared_from_this();
+      m_socket.async_read_some(asio::buffer(&m_shared_memory_close_probe, 1),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          NETRON_LOG_INFO("[" << get_id() << "] Shared Memory Peer Gone.");
+          close_socket(ec ? ec : std::make_error_code(std::errc::protocol_error));
+        }
+      );
+
+      pump_shared_memory();
+    }
+
+    // Read and write the rings until there is nothing left to do, then sleep on the eventfd. The
+    // peer wakes this end up when it adds a message or makes room for one.
+    void pump_shared_memory()
+    {
+      if (!m_shared_memory_wait)
+        return;
+
+      auto& incoming = m_shared_memory->incoming();
+      incoming.header().is_reader_sleeping.store(0, std::memory_order_relaxed);
+
+      const auto spin = std::chrono::microseconds(m_owner_config.shared_memory_spin);
+      auto spin_deadline = std::chrono::steady_clock::now() + spin;
+      for (size_t rounds = 0; ; ++rounds)
+      {
+        const bool has_read = read_shared_memory();
+        if (!m_shared_memory_wait)
+          return;
+        write_shared_memory();
+
+        // Other connections on this context get their turn before a busy peer is served again
+        if (has_read && rounds >= 64)
+        {
+          auto self = this->shared_from_this();
+          asio::post(m_asio_context, [this, self]() { pump_shared_memory(); });
+          return;
+        }
+
+        if (incoming.readable() > 0)
+          continue;
+
+        if (spin.count() > 0)
+        {
+          const auto now = std::chrono::steady_clock::now();
+          if (has_read)
+            spin_deadline = now + spin;
+          if (now < spin_deadline)
+            continue;
+        }
+
+        // Announce the sleep before looking once more, the writer either sees the flag or its message is read here
+        incoming.header().is_reader_sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (incoming.readable() == 0)
+          break;
+        incoming.header().is_reader_sleeping.store(0, std::memory_order_relaxed);
+      }
+
+      auto self = this->shared_from_this();
+      m_shared_memory_wait->async_read_some(asio::buffer(&m_shared_memory_wakeups, sizeof(m_shared_memory_wakeups)),
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (!ec)
+            pump_shared_memory();
+        }
+      );
+    }
+
+    // Deliver the messages in the incoming ring, returns true if there were any
+    bool read_shared_memory()
+    {
+      auto& ring = m_shared_memory->incoming();
+      uint64_t available = ring.readable();
+      bool has_read = false;
+
+      // The positions live in memory the peer writes to, a ring claiming more than it holds is corrupt
+      if (available > ring.capacity())
+      {
+        NETRON_LOG_WARNING("[" << get_id() << "] Shared memory ring claims " << available << " readable bytes");
+        close_socket(std::make_error_code(std::errc::bad_message));
+        return has_read;
+      }
+
+      while (available >= sizeof(wire_header<T>))
+      {
+        ring.read(0, &m_header_in, sizeof(wire_header<T>));
+        const uint64_t frame_size = sizeof(wire_header<T>) + uint64_t(m_header_in.size);
+        if (!from_wire(m_header_in, m_msg_temp_in.header))
+        {
+          NETRON_LOG_WARNING("[" << get_id() << "] Invalid Message Id " << uint64_t(m_header_in.id));
+          close_socket(std::make_error_code(std::errc::bad_message));
+          return has_read;
+        }
+
+        if (m_msg_temp_in.header.size > m_owner_config.max_message_size || frame_size > available || frame_size > ring.capacity())
+        {
+          NETRON_LOG_INFO("[" << get_id() << "] Read Header Fail.");
+          close_socket(asio::error::message_size);
+          return has_read;
+        }
+
+        m_msg_temp_in.body.resize(m_msg_temp_in.header.size);
+        ring.read(sizeof(wire_header<T>), m_msg_temp_in.body.data(), m_msg_temp_in.body.size());
+        ring.consume(frame_size);
+        available -= frame_size;
+        has_read = true;
+
+        handle_incoming(m_msg_temp_in);
+      }
+
+      // The writer waits for room, it sees the consumed bytes once woken
+      if (has_read)
+      {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto& waiting = ring.header().is_writer_waiting;
+        if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0))
+          m_shared_memory->wake_peer();
+      }
+      return has_read;
+    }
+
+    // Copy queued messages into the outgoing ring as long as they fit
+    void write_shared_memory()
+    {
+      auto& ring = m_shared_memory->outgoing();
+      bool has_written = false;
+
+      while (!m_messages_out.empty())
+      {
+        const auto& msg = m_messages_out.front().msg;
+        const uint64_t frame_size = sizeof(wire_header<T>) + msg.body.size();
+        if (msg.size() > m_remote_config.max_message_size || frame_size > ring.capacity())
+        {
+          NETRON_LOG_WARNING("[" << get_id() << "] Message of " << msg.size() << " bytes does not fit the shared memory");
+          auto out = m_messages_out.pop_front();
+          if (out.handler)
+            out.handler(asio::error::message_size);
+          continue;
+        }
+
+        if (ring.writable() < frame_size)
+        {
+          // Ask the reader for a wake-up once it has made room, then look once more
+          auto& waiting = ring.header().is_writer_waiting;
+          waiting.store(1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if (ring.writable() < frame_size)
+            break;
+          waiting.store(0, std::memory_order_relaxed);
+        }
+
+        wire_header<T> header = to_wire(msg.header);
+        header.size = uint32_t(msg.body.size());
+        ring.write(0, &header, sizeof(header));
+        ring.write(sizeof(header), msg.body.data(), msg.body.size());
+        ring.commit(frame_size);
+        has_written = true;
+        finish_message();
+      }
+
+      if (has_written)
+      {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto& sleeping = ring.header().is_reader_sleeping;
+        if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(0))
+          m_shared_memory->wake_peer();
+      }
+    }
+#endif
+
+  protected:
+    // Each connection has a unique socket to a remote
+    stream_protocol::socket m_socket;
+
+    // The socket options of TCP only apply to TCP sockets, shared memory only to Unix domain sockets
+    bool m_is_tcp = false;
+    bool m_is_local = false;
+
+#ifdef NETRON_HAS_SHARED_MEMORY
+    // Rings shared with the peer and the eventfd this end sleeps on, set once both ends switched to shared memory
+    std::unique_ptr<shared_memory_channel> m_shared_memory;
+    std::unique_ptr<asio::posix::stream_descriptor> m_shared_memory_wait;
+    uint64_t m_shared_memory_wakeups = 0;
+    uint8_t m_shared_memory_close_probe = 0;
+#endif
+
+    // This context is shared with the whole asio instance
+    asio::io_context& m_asio_context;
+
+    // This queue holds all messages to be sent to the remote side of this connection
+    tsqueue<outgoing_message> m_messages_out;
+    std::vector<asio::const_buffer> m_write_buffers;
+    std::vector<uint8_t> m_file_buffer;
+    std::vector<wire_header<T>> m_write_headers;
+
+    // Messages submitted by any thread, moved to the outgoing queue by the writer on the context thread
+    mpsc_queue<outgoing_message> m_submitted;
+
+    // Sends not yet in m_messages_out, submitted or held back by coalescing, for the queue depth gauge
+    std::atomic<uint64_t> m_pending_sends{ 0 };
+    std::atomic<bool> m_is_writer_awake{ false };
+    std::vector<uint32_t> m_write_checksums;
+    uint32_t m_payload_checksum = 0;
+    uint32_t m_checksum_in = 0;
+
+    // This queue holds all messages that have been received from the remote side of this connection
+    tsqueue<owned_message<T>>& m_messages_in;
+    message<T> m_msg_temp_in;
+    wire_header<T> m_header_in{};
+    std::shared_ptr<spooled_body> m_spooled_in;
+
+    // Owner of this connection
+    owner m_owner_type = owner::server;
+
+    // Identifier of client
+    uint32_t m_id = 0;
+
+    // Handshake validation
+    uint64_t m_handshake_out = 0;
+    uint64_t m_handshake_in = 0;
+    uint64_t m_handshake_check = 0;
+
+    // Client's and server's configuration
+    config_view m_owner_config;
+    wire_config m_remote_config;
+
+    // The owner's config as it is sent
+    wire_config m_config_out;
 
     // Is connection ready of message exchange
-    bool m_is_ready = false;
+    std::atomic<bool> m_is_ready{ false };
+
+    // Deadline for the remote to finish the handshake
+    asio::steady_timer m_handshake_timer;
+
+    // Client side notifications about the state of the connection
+    std::function<void(std::error_code)> m_connect_handler;
+    std::function<void(std::error_code)> m_disconnect_handler;
+
+    // Receives replies to calls
+    std::function<void(message<T>&)> m_reply_handler;
+
+    // Traffic counters
+    connection_metrics m_metrics;
+
+    // Unreliable channel, the server shares its UDP socket between all connections. Only touched on
+    // the context thread, apart from the ready flag.
+    std::shared_ptr<udp_channel> m_udp_channel;
+    asio::ip::udp::endpoint m_udp_remote;
+    uint64_t m_datagram_key = 0;
+    std::atomic<bool> m_is_udp_ready{ false };
+    asio::steady_timer m_udp_timer;
+    uint32_t m_udp_sequence = 0;
+    std::unordered_map<T, uint32_t> m_udp_sequences;
+
+    // Sends held back by coalescing, filled by any thread and handed over in one post
+    std::mutex m_coalesce_mutex;
+    std::vector<outgoing_message> m_coalesced;
+    uint64_t m_coalesced_bytes = 0;
+    asio::steady_timer m_coalesce_timer;
+
+    // Inbound rate limits, reading waits on the timer while either bucket is overdrawn
+    token_bucket m_message_bucket;
+    token_bucket m_byte_bucket;
+    asio::steady_timer m_read_timer;
+
+    // Graceful shutdown in progress, only touched on the context thread
+    std::function<void(size_t)> m_shutdown_handler;
+    std::chrono::steady_clock::time_point m_drain_deadline;
+    asio::steady_timer m_drain_timer;
+    size_t m_shutdown_dropped = 0;
+    bool m_is_half_closed = false;
+
+    // In-process connections have no socket, messages go straight to the peer's context
+    bool m_is_in_process = false;
+    std::atomic<bool> m_is_in_process_open{ false };
+    std::weak_ptr<connection<T>> m_peer;
+
+    // Messages are delivered to receive() instead of the incoming queue, only touched on the context thread
+    bool m_is_receiving = false;
+    std::deque<message<T>> m_messages_received;
+    std::function<void(std::error_code, message<T>)> m_receive_handler;
   };
 
 }
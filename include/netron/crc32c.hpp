@@ -0,0 +1,146 @@
+#pragma once
+
+#include <netron/common.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define NETRON_CRC32C_SSE42 1
+  #include <nmmintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #endif
+#elif defined(__ARM_FEATURE_CRC32)
+  #define NETRON_CRC32C_ARMV8 1
+  #include <arm_acle.h>
+#endif
+
+namespace netron
+{
+
+  namespace detail
+  {
+
+    // Slice-by-8 tables of the reflected Castagnoli polynomial
+    struct crc32c_tables
+    {
+      uint32_t table[8][256];
+
+      crc32c_tables()
+      {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+          uint32_t crc = i;
+          for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+          table[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i)
+          for (int slice = 1; slice < 8; ++slice)
+            table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+      }
+    };
+
+    inline uint32_t crc32c_slice_by_8(uint32_t crc, const uint8_t* data, size_t size)
+    {
+      static const crc32c_tables tables;
+      const auto& t = tables.table;
+
+      // Bytes are combined explicitly so the result does not depend on the host's byte order
+      for (; size >= 8; data += 8, size -= 8)
+      {
+        const uint32_t low = crc ^ (uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24);
+        const uint32_t high = uint32_t(data[4]) | uint32_t(data[5]) << 8 | uint32_t(data[6]) << 16 | uint32_t(data[7]) << 24;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+          ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+      }
+
+      for (; size > 0; ++data, --size)
+        crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+      return crc;
+    }
+
+#if defined(NETRON_CRC32C_SSE42)
+  #if defined(__GNUC__)
+    __attribute__((target("sse4.2")))
+  #endif
+    inline uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t size)
+    {
+      uint64_t crc64 = crc;
+      for (; size >= 8; data += 8, size -= 8)
+      {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+      }
+
+      crc = uint32_t(crc64);
+      for (; size > 0; ++data, --size)
+        crc = _mm_crc32_u8(crc, *data);
+      return crc;
+    }
+
+    inline bool has_sse42()
+    {
+  #if defined(_MSC_VER)
+      int info[4];
+      __cpuid(info, 1);
+      return (info[2] & (1 << 20)) != 0;
+  #else
+      return __builtin_cpu_supports("sse4.2");
+  #endif
+    }
+#elif defined(NETRON_CRC32C_ARMV8)
+    inline uint32_t crc32c_armv8(uint32_t crc, const uint8_t* data, size_t size)
+    {
+      for (; size >= 8; data += 8, size -= 8)
+      {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+      }
+
+      for (; size > 0; ++data, --size)
+        crc = __crc32cb(crc, *data);
+      return crc;
+    }
+#endif
+
+  }
+
+  // CRC32C (Castagnoli) of size bytes continuing from crc, 0 to start. Runs on the SSE 4.2 crc32
+  // instruction where the CPU has it, on the ARMv8 CRC instructions where the build targets them,
+  // and on slice-by-8 tables everywhere else.
+  inline uint32_t crc32c(uint32_t crc, const void* data, size_t size)
+  {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+#if defined(NETRON_CRC32C_SSE42)
+    static const bool is_accelerated = detail::has_sse42();
+    if (is_accelerated)
+      return ~detail::crc32c_sse42(~crc, bytes, size);
+    return ~detail::crc32c_slice_by_8(~crc, bytes, size);
+#elif defined(NETRON_CRC32C_ARMV8)
+    return ~detail::crc32c_armv8(~crc, bytes, size);
+#else
+    return ~detail::crc32c_slice_by_8(~crc, bytes, size);
+#endif
+  }
+
+  // The table-driven CRC32C, the same result as crc32c on any CPU
+  inline uint32_t crc32c_portable(uint32_t crc, const void* data, size_t size)
+  {
+    return ~detail::crc32c_slice_by_8(~crc, static_cast<const uint8_t*>(data), size);
+  }
+
+  // Name of the implementation crc32c runs on
+  inline const char* crc32c_implementation()
+  {
+#if defined(NETRON_CRC32C_SSE42)
+    return detail::has_sse42() ? "sse4.2" : "slice-by-8";
+#elif defined(NETRON_CRC32C_ARMV8)
+    return "armv8";
+#else
+    return "slice-by-8";
+#endif
+  }
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <netron/common.hpp>
+#include <netron/asio.hpp>
+
+namespace netron
+{
+
+  // Every datagram starts with the key of the connection it belongs to and its sequence number,
+  // a message header and body follow. Sequence 0 is a hello that carries no message.
+#pragma pack(push, 1)
+  struct datagram_header
+  {
+    uint64_t key = 0;
+    uint32_t sequence = 0;
+  };
+#pragma pack(pop)
+
+  // Largest UDP payload over IPv4, datagrams above the path MTU are fragmented by IP
+  constexpr size_t max_datagram_size = 65507;
+
+  // A UDP socket carrying the datagrams of one or more connections. The server shares one between
+  // all its connections, a client connection has its own.
+  class udp_channel : public std::enable_shared_from_this<udp_channel>
+  {
+  public:
+    using receive_handler = std::function<void(const datagram_header& header, const uint8_t* data, size_t size, const asio::ip::udp::endpoint& from)>;
+
+    udp_channel(asio::io_context& context, const asio::ip::udp::endpoint& local)
+      : m_socket(context), m_buffer(max_datagram_size)
+    {
+      m_socket.open(local.protocol());
+      m_socket.bind(local);
+
+      // A full send buffer drops the datagram instead of holding up the sender
+      m_socket.non_blocking(true);
+    }
+
+    // (ASYNC) Pass every datagram that is large enough to carry a header to the handler, runs on the
+    // channel's context and keeps the channel alive until close
+    void start_receiving(receive_handler handler)
+    {
+      m_handler = std::move(handler);
+      receive();
+    }
+
+    // Send a datagram, may be called from any thread. Returns false if it was dropped.
+    template<typename ConstBufferSequence>
+    bool send_to(const asio::ip::udp::endpoint& destination, const ConstBufferSequence& buffers)
+    {
+      // Sending is a single non-blocking sendto, the lock only keeps callers off each other
+      std::lock_guard<std::mutex> lock(m_send_mutex);
+      asio::error_code ec;
+      m_socket.send_to(buffers, destination, 0, ec);
+      return !ec;
+    }
+
+    void close()
+    {
+      asio::error_code ec;
+      m_socket.close(ec);
+    }
+
+    asio::ip::udp::endpoint local_endpoint() const
+    {
+      asio::error_code ec;
+      return m_socket.local_endpoint(ec);
+    }
+
+  private:
+    void receive()
+    {
+      auto self = shared_from_this();
+      m_socket.async_receive_from(asio::buffer(m_buffer), m_sender,
+        [this, self](std::error_code ec, std::size_t length)
+        {
+          if (ec == asio::error::operation_aborted || !m_socket.is_open())
+            return;
+
+          if (!ec && length >= sizeof(datagram_header))
+          {
+            datagram_header header;
+            std::memcpy(&header, m_buffer.data(), sizeof(header));
+            m_handler(header, m_buffer.data() + sizeof(header), length - sizeof(header), m_sender);
+          }
+
+          // Errors of earlier sends are reported here on some systems, they do not end the channel
+          receive();
+        }
+      );
+    }
+
+  private:
+    asio::ip::udp::socket m_socket;
+    std::vector<uint8_t> m_buffer;
+    asio::ip::udp::endpoint m_sender;
+    receive_handler m_handler;
+    std::mutex m_send_mutex;
+  };
+
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <netron/common.hpp>
+
+// Messages below this level are compiled out: 0 trace, 1 debug, 2 info, 3 warning, 4 error, 5 off
+#ifndef NETRON_LOG_LEVEL
+  #define NETRON_LOG_LEVEL 0
+#endif
+
+namespace netron
+{
+
+  enum class log_level : int
+  {
+    trace,
+    debug,
+    info,
+    warning,
+    error,
+    off,
+  };
+
+  inline const char* to_string(log_level level)
+  {
+    switch (level)
+    {
+    case log_level::trace: return "trace";
+    case log_level::debug: return "debug";
+    case log_level::info: return "info";
+    case log_level::warning: return "warning";
+    case log_level::error: return "error";
+    default: return "off";
+    }
+  }
+
+  // Receives formatted log lines, may be called from any thread
+  class log_sink
+  {
+  public:
+    virtual ~log_sink() = default;
+    virtual void write(log_level level, const char* text, size_t size) = 0;
+  };
+
+  // Writes lines to a stream, warnings and errors go to a separate one
+  class ostream_sink : public log_sink
+  {
+  public:
+    ostream_sink(std::ostream& out = std::cout, std::ostream& err = std::cerr)
+      : m_out(out), m_err(err)
+    {}
+
+    void write(log_level level, const char* text, size_t size) override
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::ostream& os = level >= log_level::warning ? m_err : m_out;
+      os.write(text, size);
+      os.put('\n');
+      os.flush();
+    }
+
+  private:
+    std::ostream& m_out;
+    std::ostream& m_err;
+    std::mutex m_mutex;
+  };
+
+  // Hands lines to a background thread through a bounded lock-free ring, so the logging thread
+  // never waits on the target sink. Lines are truncated to the slot size and dropped when the
+  // ring is full.
+  class async_sink : public log_sink
+  {
+  public:
+    static constexpr size_t line_size = 240;
+
+    async_sink(std::shared_ptr<log_sink> target, size_t capacity = 4096)
+      : m_target(std::move(target))
+    {
+      // The capacity is rounded up to a power of two so a slot is found with a mask
+      size_t size = 2;
+      while (size < capacity)
+        size <<= 1;
+
+      m_slots = std::unique_ptr<slot[]>(new slot[size]);
+      m_mask = size - 1;
+      for (size_t i = 0; i < size; ++i)
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+
+      m_thread = std::thread([this]() { run(); });
+    }
+
+    ~async_sink()
+    {
+      m_is_running = false;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cv.notify_one();
+      }
+      m_thread.join();
+    }
+
+    void write(log_level level, const char* text, size_t size) override
+    {
+      // Claim a slot, bounded MPMC ring: a slot is free when its sequence equals the position
+      size_t position = m_write_position.load(std::memory_order_relaxed);
+      slot* s;
+      for (;;)
+      {
+        s = &m_slots[position & m_mask];
+        const size_t sequence = s->sequence.load(std::memory_order_acquire);
+        const intptr_t difference = intptr_t(sequence) - intptr_t(position);
+        if (difference == 0)
+        {
+          if (m_write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if (difference < 0)
+        {
+          m_dropped.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        else
+        {
+          position = m_write_position.load(std::memory_order_relaxed);
+        }
+      }
+
+      s->level = level;
+      s->size = std::min(size, line_size);
+      std::memcpy(s->text, text, s->size);
+      s->sequence.store(position + 1, std::memory_order_release);
+
+      // Only wake the writer thread when it has gone to sleep
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_is_sleeping.load(std::memory_order_relaxed) && m_is_sleeping.exchange(false))
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cv.notify_one();
+      }
+    }
+
+    // Number of lines lost because the ring was full
+    uint64_t dropped() const
+    {
+      return m_dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct slot
+    {
+      std::atomic<size_t> sequence{ 0 };
+      log_level level = log_level::info;
+      size_t size = 0;
+      char text[line_size];
+    };
+
+    // Pops the next line into the target sink, returns false if the ring is empty
+    bool drain_one()
+    {
+      slot& s = m_slots[m_read_position & m_mask];
+      if (s.sequence.load(std::memory_order_acquire) != m_read_position + 1)
+        return false;
+
+      m_target->write(s.level, s.text, s.size);
+      s.sequence.store(m_read_position + m_mask + 1, std::memory_order_release);
+      m_read_position++;
+      return true;
+    }
+
+    void run()
+    {
+      while (m_is_running)
+      {
+        while (drain_one());
+
+        // Announce the sleep before checking once more, a writer either sees the flag or its line is drained
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_is_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (drain_one())
+        {
+          m_is_sleeping = false;
+          continue;
+        }
+        m_cv.wait_for(lock, std::chrono::milliseconds(100));
+        m_is_sleeping = false;
+      }
+
+      while (drain_one());
+    }
+
+  private:
+    std::shared_ptr<log_sink> m_target;
+    std::unique_ptr<slot[]> m_slots;
+    size_t m_mask = 0;
+
+    std::atomic<size_t> m_write_position{ 0 };
+    size_t m_read_position = 0;
+    std::atomic<uint64_t> m_dropped{ 0 };
+
+    std::atomic<bool> m_is_running{ true };
+    std::atomic<bool> m_is_sleeping{ false };
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+  };
+
+  // Process wide logger used by the library. By default lines of level info and above are
+  // written to std::cout/std::cerr through an async_sink.
+  class logger
+  {
+  public:
+    static bool is_enabled(log_level level)
+    {
+      return int(level) >= NETRON_LOG_LEVEL && level >= instance().m_level.load(std::memory_order_relaxed);
+    }
+
+    static void set_level(log_level level)
+    {
+      instance().m_level = level;
+    }
+
+    // Replace the sink, a null sink discards all lines
+    static void set_sink(std::shared_ptr<log_sink> sink)
+    {
+      auto& l = instance();
+      std::lock_guard<std::mutex> lock(l.m_mutex);
+
+      // Sinks are kept alive, a thread may still be writing to the previous one
+      if (sink)
+        l.m_sinks.push_back(sink);
+      l.m_sink = sink.get();
+    }
+
+    static void write(log_level level, const std::string& text)
+    {
+      log_sink* sink = instance().m_sink.load(std::memory_order_acquire);
+      if (sink)
+        sink->write(level, text.data(), text.size());
+    }
+
+    // Reused per thread so formatting a line does not construct a stream
+    static std::ostringstream& stream()
+    {
+      thread_local std::ostringstream os;
+      os.str(std::string());
+      return os;
+    }
+
+  private:
+    logger()
+    {
+      auto sink = std::make_shared<async_sink>(std::make_shared<ostream_sink>());
+      m_sinks.push_back(sink);
+      m_sink = sink.get();
+    }
+
+    static logger& instance()
+    {
+      static logger l;
+      return l;
+    }
+
+  private:
+    std::atomic<log_level> m_level{ log_level::info };
+    std::atomic<log_sink*> m_sink{ nullptr };
+    std::vector<std::shared_ptr<log_sink>> m_sinks;
+    std::mutex m_mutex;
+  };
+
+}
+
+#define NETRON_LOG(level, expression) \
+  do \
+  { \
+    if (::netron::logger::is_enabled(level)) \
+    { \
+      auto& netron_log_stream = ::netron::logger::stream(); \
+      netron_log_stream << expression; \
+      ::netron::logger::write(level, netron_log_stream.str()); \
+    } \
+  } while (0)
+
+#define NETRON_LOG_DISABLED(expression) do {} while (0)
+
+#if NETRON_LOG_LEVEL <= 0
+  #define NETRON_LOG_TRACE(expression) NETRON_LOG(::netron::log_level::trace, expression)
+#else
+  #define NETRON_LOG_TRACE(expression) NETRON_LOG_DISABLED(expression)
+#endif
+
+#if NETRON_LOG_LEVEL <= 1
+  #define NETRON_LOG_DEBUG(expression) NETRON_LOG(::netron::log_level::debug, expression)
+#else
+  #define NETRON_LOG_DEBUG(expression) NETRON_LOG_DISABLED(expression)
+#endif
+
+#if NETRON_LOG_LEVEL <= 2
+  #define NETRON_LOG_INFO(expression) NETRON_LOG(::netron::log_level::info, expression)
+#else
+  #define NETRON_LOG_INFO(expression) NETRON_LOG_DISABLED(expression)
+#endif
+
+#if NETRON_LOG_LEVEL <= 3
+  #define NETRON_LOG_WARNING(expression) NETRON_LOG(::netron::log_level::warning, expression)
+#else
+  #define NETRON_LOG_WARNING(expression) NETRON_LOG_DISABLED(expression)
+#endif
+
+#if NETRON_LOG_LEVEL <= 4
+  #define NETRON_LOG_ERROR(expression) NETRON_LOG(::netron::log_level::error, expression)
+#else
+  #define NETRON_LOG_ERROR(expression) NETRON_LOG_DISABLED(expression)
+#endif
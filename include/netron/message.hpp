@@ -3,13 +3,175 @@
 namespace netron
 {
 
+  // Ids of the message enum T. By default every value is accepted and ids are sent in T's underlying
+  // type. Specialise it as a message_ids list to have unknown ids rejected on receive and ids sent
+  // in the smallest type that holds them:
+  //
+  //   namespace netron {
+  //     template<> struct message_id_traits<MyMessages> : message_ids<MyMessages, MyMessages::A, MyMessages::B> {};
+  //   }
+  template<typename T>
+  struct message_id_traits
+  {
+    using wire_type = typename std::conditional<std::is_enum<T>::value, std::underlying_type<T>, std::common_type<T>>::type::type;
+
+    // Identifies the accepted ids in the config exchange, 0 accepts every id
+    static constexpr uint64_t ids_hash = 0;
+
+    static constexpr bool is_valid(uint64_t)
+    {
+      return true;
+    }
+  };
+
+  namespace detail
+  {
+
+    template<size_t WordCount>
+    struct id_bitmap
+    {
+      uint64_t words[WordCount];
+    };
+
+    template<typename... Ids>
+    constexpr uint64_t max_id(Ids... ids)
+    {
+      const uint64_t values[] = { uint64_t(ids)... };
+      uint64_t max = 0;
+      for (uint64_t value : values)
+        max = value > max ? value : max;
+      return max;
+    }
+
+    template<typename... Ids>
+    constexpr bool are_ids_non_negative(Ids... ids)
+    {
+      const int64_t values[] = { int64_t(ids)... };
+      for (int64_t value : values)
+        if (value < 0)
+          return false;
+      return true;
+    }
+
+    template<size_t WordCount, typename... Ids>
+    constexpr id_bitmap<WordCount> make_id_bitmap(Ids... ids)
+    {
+      id_bitmap<WordCount> bitmap{};
+      const uint64_t values[] = { uint64_t(ids)... };
+      for (uint64_t value : values)
+        bitmap.words[value / 64] |= uint64_t(1) << (value % 64);
+      return bitmap;
+    }
+
+    // FNV-1a over the words of the bitmap, the same ids hash the same in any order
+    template<size_t WordCount>
+    constexpr uint64_t hash_id_bitmap(const id_bitmap<WordCount>& bitmap)
+    {
+      uint64_t hash = 0xcbf29ce484222325;
+      for (uint64_t word : bitmap.words)
+        for (int byte = 0; byte < 8; ++byte)
+          hash = (hash ^ ((word >> (8 * byte)) & 0xFF)) * 0x100000001b3;
+      return hash;
+    }
+
+  }
+
+  // The valid ids of T for message_id_traits. They are checked against a bitmap built at compile
+  // time and sent in a single byte if the largest is below 256, in two bytes otherwise.
+  template<typename T, T... Ids>
+  struct message_ids
+  {
+    static_assert(sizeof...(Ids) > 0, "List at least one message id");
+    static_assert(detail::are_ids_non_negative(Ids...), "Message ids cannot be negative");
+
+    static constexpr uint64_t max_id = detail::max_id(Ids...);
+    static_assert(max_id <= 0xFFFF, "Message ids above 65535 cannot be listed");
+
+    using wire_type = typename std::conditional<max_id <= 0xFF, uint8_t, uint16_t>::type;
+
+    static constexpr detail::id_bitmap<max_id / 64 + 1> bitmap = detail::make_id_bitmap<max_id / 64 + 1>(Ids...);
+
+    static constexpr uint64_t ids_hash = detail::hash_id_bitmap(bitmap);
+
+    static constexpr bool is_valid(uint64_t id)
+    {
+      return id <= max_id && ((bitmap.words[id / 64] >> (id % 64)) & 1) != 0;
+    }
+  };
+
+  template<typename T, T... Ids>
+  constexpr detail::id_bitmap<message_ids<T, Ids...>::max_id / 64 + 1> message_ids<T, Ids...>::bitmap;
+
   // Message Header is sent at the start of every message
   template<typename T>
   struct message_header
   {
+    static_assert(std::is_enum<T>::value || std::is_integral<T>::value, "Message ids are an enum or an integer type");
+
     T id{};
     uint32_t size = 0;
+
+    // Non-zero for requests made with client_interface::call, replies carry the same value back.
+    // Only the lower 31 bits are sent, the top bit carries is_reply.
+    uint32_t correlation_id = 0;
+
+    // Set by server_interface::reply, only replies complete a call, anything else carrying its
+    // correlation id is an ordinary message
+    bool is_reply = false;
+  };
+
+  // Bit of the wire correlation id that marks a reply
+  constexpr uint32_t reply_bit = 0x80000000u;
+
+  // The header as it is written to sockets, rings and datagrams, packed and with the id in the
+  // wire type of message_id_traits<T>
+#pragma pack(push, 1)
+  template<typename T>
+  struct wire_header
+  {
+    typename message_id_traits<T>::wire_type id;
+    uint32_t size;
+    uint32_t correlation_id;
   };
+#pragma pack(pop)
+
+  template<typename T>
+  wire_header<T> to_wire(const message_header<T>& header)
+  {
+    static_assert(sizeof(wire_header<T>) == sizeof(typename message_id_traits<T>::wire_type) + 2 * sizeof(uint32_t), "The wire header has to be packed");
+    static_assert(std::is_trivially_copyable<wire_header<T>>::value, "The wire header is copied as raw bytes");
+
+    wire_header<T> wire;
+    wire.id = typename message_id_traits<T>::wire_type(header.id);
+    wire.size = header.size;
+    wire.correlation_id = (header.correlation_id & ~reply_bit) | (header.is_reply ? reply_bit : 0);
+    return wire;
+  }
+
+  // Returns false for an id message_id_traits<T> does not accept
+  template<typename T>
+  bool from_wire(const wire_header<T>& wire, message_header<T>& header)
+  {
+    if (!message_id_traits<T>::is_valid(uint64_t(wire.id)))
+      return false;
+
+    header.id = T(wire.id);
+    header.size = wire.size;
+    header.correlation_id = wire.correlation_id & ~reply_bit;
+    header.is_reply = (wire.correlation_id & reply_bit) != 0;
+    return true;
+  }
+
+  // Whether a header can be sent, its id has to survive the trip through the wire type
+  template<typename T>
+  bool is_valid_id(const message_header<T>& header)
+  {
+    using wire_type = typename message_id_traits<T>::wire_type;
+    return message_id_traits<T>::is_valid(uint64_t(header.id)) && T(wire_type(header.id)) == header.id;
+  }
+
+  // Forward declaration of the memory-mapped body of a spooled message
+  class spooled_body;
 
   template<typename T>
   struct message
@@ -17,6 +179,10 @@ namespace netron
     message_header<T> header{};
     std::vector<uint8_t> body;
 
+    // Bodies of at least config::spool_threshold bytes are received into a memory-mapped temporary
+    // file, body stays empty and this read-only view holds the bytes instead
+    std::shared_ptr<const spooled_body> spooled;
+
     // Returns the size of the entire message in bytes
     size_t size() const
     {
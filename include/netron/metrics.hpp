@@ -0,0 +1,357 @@
+#pragma once
+
+#include <netron/common.hpp>
+
+namespace netron
+{
+
+  // Latency histogram with power of two buckets, bucket i counts samples below 2^i microseconds
+  struct latency_histogram_snapshot
+  {
+    static constexpr size_t bucket_count = 32;
+
+    uint64_t buckets[bucket_count] = {};
+    uint64_t count = 0;
+    uint64_t sum_us = 0;
+
+    latency_histogram_snapshot& operator+=(const latency_histogram_snapshot& other)
+    {
+      for (size_t i = 0; i < bucket_count; ++i)
+        buckets[i] += other.buckets[i];
+      count += other.count;
+      sum_us += other.sum_us;
+      return *this;
+    }
+
+    // Upper bound of the bucket the given fraction of samples falls into, e.g. 0.99
+    uint64_t percentile_us(double fraction) const
+    {
+      const uint64_t rank = uint64_t(fraction * count);
+      uint64_t seen = 0;
+      for (size_t i = 0; i < bucket_count; ++i)
+      {
+        seen += buckets[i];
+        if (seen > rank)
+          return uint64_t(1) << i;
+      }
+      return uint64_t(1) << (bucket_count - 1);
+    }
+  };
+
+  class latency_histogram
+  {
+  public:
+    void record(std::chrono::steady_clock::duration latency)
+    {
+      const uint64_t us = uint64_t(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(latency).count()));
+
+      // The bucket is the bit width of the value, so it holds values below 2^bucket
+      size_t bucket = 0;
+      for (uint64_t v = us; v != 0 && bucket < latency_histogram_snapshot::bucket_count - 1; v >>= 1)
+        bucket++;
+
+      m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+      m_count.fetch_add(1, std::memory_order_relaxed);
+      m_sum_us.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    void add(const latency_histogram_snapshot& other)
+    {
+      for (size_t i = 0; i < latency_histogram_snapshot::bucket_count; ++i)
+        m_buckets[i].fetch_add(other.buckets[i], std::memory_order_relaxed);
+      m_count.fetch_add(other.count, std::memory_order_relaxed);
+      m_sum_us.fetch_add(other.sum_us, std::memory_order_relaxed);
+    }
+
+    latency_histogram_snapshot snapshot() const
+    {
+      latency_histogram_snapshot s;
+      for (size_t i = 0; i < latency_histogram_snapshot::bucket_count; ++i)
+        s.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+      s.count = m_count.load(std::memory_order_relaxed);
+      s.sum_us = m_sum_us.load(std::memory_order_relaxed);
+      return s;
+    }
+
+  private:
+    std::atomic<uint64_t> m_buckets[latency_histogram_snapshot::bucket_count] = {};
+    std::atomic<uint64_t> m_count{ 0 };
+    std::atomic<uint64_t> m_sum_us{ 0 };
+  };
+
+  // Counters of one connection, or the sum over many
+  struct connection_metrics_snapshot
+  {
+    uint32_t id = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t messages_sent = 0;
+    uint64_t messages_received = 0;
+    uint64_t handshake_failures = 0;
+
+    // Messages dropped with their connection because their checksum did not match
+    uint64_t checksum_failures = 0;
+
+    // Times reading paused because the connection went over config::max_message_rate or max_byte_rate
+    uint64_t rate_limit_pauses = 0;
+
+    // Datagrams dropped because the connection was over its rate limits, they are not waited for
+    uint64_t rate_limit_drops = 0;
+
+    // Messages waiting to be written
+    uint64_t outgoing_queue_depth = 0;
+
+    // Time from send() to the message being fully written to the socket
+    latency_histogram_snapshot write_latency;
+
+    connection_metrics_snapshot& operator+=(const connection_metrics_snapshot& other)
+    {
+      bytes_sent += other.bytes_sent;
+      bytes_received += other.bytes_received;
+      messages_sent += other.messages_sent;
+      messages_received += other.messages_received;
+      handshake_failures += other.handshake_failures;
+      checksum_failures += other.checksum_failures;
+      rate_limit_pauses += other.rate_limit_pauses;
+      rate_limit_drops += other.rate_limit_drops;
+      outgoing_queue_depth += other.outgoing_queue_depth;
+      write_latency += other.write_latency;
+      return *this;
+    }
+  };
+
+  // Relaxed atomic counters, written by the connection's context thread and read from anywhere
+  class connection_metrics
+  {
+  public:
+    void message_sent(size_t bytes, std::chrono::steady_clock::duration latency)
+    {
+      m_bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+      m_messages_sent.fetch_add(1, std::memory_order_relaxed);
+      m_write_latency.record(latency);
+    }
+
+    void message_received(size_t bytes)
+    {
+      m_bytes_received.fetch_add(bytes, std::memory_order_relaxed);
+      m_messages_received.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void handshake_failed()
+    {
+      m_handshake_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void checksum_failed()
+    {
+      m_checksum_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void rate_limited()
+    {
+      m_rate_limit_pauses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void rate_limit_dropped()
+    {
+      m_rate_limit_drops.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Fold in the counters of a connection that is gone
+    void add(const connection_metrics_snapshot& other)
+    {
+      m_bytes_sent.fetch_add(other.bytes_sent, std::memory_order_relaxed);
+      m_bytes_received.fetch_add(other.bytes_received, std::memory_order_relaxed);
+      m_messages_sent.fetch_add(other.messages_sent, std::memory_order_relaxed);
+      m_messages_received.fetch_add(other.messages_received, std::memory_order_relaxed);
+      m_handshake_failures.fetch_add(other.handshake_failures, std::memory_order_relaxed);
+      m_checksum_failures.fetch_add(other.checksum_failures, std::memory_order_relaxed);
+      m_rate_limit_pauses.fetch_add(other.rate_limit_pauses, std::memory_order_relaxed);
+      m_rate_limit_drops.fetch_add(other.rate_limit_drops, std::memory_order_relaxed);
+      m_write_latency.add(other.write_latency);
+    }
+
+    connection_metrics_snapshot snapshot() const
+    {
+      connection_metrics_snapshot s;
+      s.bytes_sent = m_bytes_sent.load(std::memory_order_relaxed);
+      s.bytes_received = m_bytes_received.load(std::memory_order_relaxed);
+      s.messages_sent = m_messages_sent.load(std::memory_order_relaxed);
+      s.messages_received = m_messages_received.load(std::memory_order_relaxed);
+      s.handshake_failures = m_handshake_failures.load(std::memory_order_relaxed);
+      s.checksum_failures = m_checksum_failures.load(std::memory_order_relaxed);
+      s.rate_limit_pauses = m_rate_limit_pauses.load(std::memory_order_relaxed);
+      s.rate_limit_drops = m_rate_limit_drops.load(std::memory_order_relaxed);
+      s.write_latency = m_write_latency.snapshot();
+      return s;
+    }
+
+  private:
+    std::atomic<uint64_t> m_bytes_sent{ 0 };
+    std::atomic<uint64_t> m_bytes_received{ 0 };
+    std::atomic<uint64_t> m_messages_sent{ 0 };
+    std::atomic<uint64_t> m_messages_received{ 0 };
+    std::atomic<uint64_t> m_handshake_failures{ 0 };
+    std::atomic<uint64_t> m_checksum_failures{ 0 };
+    std::atomic<uint64_t> m_rate_limit_pauses{ 0 };
+    std::atomic<uint64_t> m_rate_limit_drops{ 0 };
+    latency_histogram m_write_latency;
+  };
+
+  struct server_metrics_snapshot
+  {
+    uint64_t connections_accepted = 0;
+    uint64_t connections_rejected = 0;
+    uint64_t accept_errors = 0;
+    uint64_t connection_count = 0;
+    uint64_t pending_connections = 0;
+
+    // Messages waiting for update()
+    uint64_t incoming_queue_depth = 0;
+
+    // Sum over all connections the server has had
+    connection_metrics_snapshot totals;
+
+    // Connections the server currently holds
+    std::vector<connection_metrics_snapshot> connections;
+  };
+
+  struct client_metrics_snapshot
+  {
+    uint64_t connect_failures = 0;
+    uint64_t reconnects = 0;
+
+    // Replies that arrived after their call had timed out or failed
+    uint64_t late_replies = 0;
+
+    // Messages waiting to be taken from incoming()
+    uint64_t incoming_queue_depth = 0;
+
+    // Sum over every connection the client has made
+    connection_metrics_snapshot totals;
+  };
+
+  namespace prometheus
+  {
+
+    inline void write_metric(std::ostream& os, const std::string& name, const char* type, const char* help)
+    {
+      os << "# HELP " << name << ' ' << help << '\n';
+      os << "# TYPE " << name << ' ' << type << '\n';
+    }
+
+    inline void write_histogram(std::ostream& os, const std::string& name, const std::string& labels, const latency_histogram_snapshot& h)
+    {
+      const std::string separator = labels.empty() ? "" : ",";
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i + 1 < latency_histogram_snapshot::bucket_count; ++i)
+      {
+        cumulative += h.buckets[i];
+        os << name << "_bucket{" << labels << separator << "le=\"" << double(uint64_t(1) << i) / 1e6 << "\"} " << cumulative << '\n';
+      }
+      os << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << h.count << '\n';
+
+      const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+      os << name << "_sum" << braces << ' ' << double(h.sum_us) / 1e6 << '\n';
+      os << name << "_count" << braces << ' ' << h.count << '\n';
+    }
+
+    // Each family is written once, its HELP and TYPE followed by a sample for every connection.
+    // Labelled samples carry the connection id, unlabelled ones are for the totals.
+    inline void write_connections(std::ostream& os, const std::string& prefix, const std::vector<connection_metrics_snapshot>& connections, bool labelled)
+    {
+      if (connections.empty())
+        return;
+
+      auto labels = [labelled](const connection_metrics_snapshot& c) { return labelled ? "id=\"" + std::to_string(c.id) + "\"" : std::string(); };
+      struct { const char* name; const char* type; const char* help; uint64_t connection_metrics_snapshot::* value; } counters[] = {
+        { "_bytes_sent_total", "counter", "Bytes written, headers included.", &connection_metrics_snapshot::bytes_sent },
+        { "_bytes_received_total", "counter", "Bytes read, headers included.", &connection_metrics_snapshot::bytes_received },
+        { "_messages_sent_total", "counter", "Messages written.", &connection_metrics_snapshot::messages_sent },
+        { "_messages_received_total", "counter", "Messages read.", &connection_metrics_snapshot::messages_received },
+        { "_handshake_failures_total", "counter", "Connections that failed their handshake.", &connection_metrics_snapshot::handshake_failures },
+        { "_checksum_failures_total", "counter", "Messages whose checksum did not match.", &connection_metrics_snapshot::checksum_failures },
+        { "_rate_limit_pauses_total", "counter", "Times reading paused for the rate limit.", &connection_metrics_snapshot::rate_limit_pauses },
+        { "_rate_limit_drops_total", "counter", "Datagrams dropped for the rate limit.", &connection_metrics_snapshot::rate_limit_drops },
+        { "_outgoing_queue_depth", "gauge", "Messages waiting to be written.", &connection_metrics_snapshot::outgoing_queue_depth },
+      };
+
+      for (auto& counter : counters)
+      {
+        write_metric(os, prefix + counter.name, counter.type, counter.help);
+        for (auto& c : connections)
+        {
+          const std::string series = labels(c);
+          os << prefix << counter.name << (series.empty() ? "" : "{" + series + "}") << ' ' << c.*counter.value << '\n';
+        }
+      }
+
+      write_metric(os, prefix + "_write_latency_seconds", "histogram", "Time from send to the message being written.");
+      for (auto& c : connections)
+        write_histogram(os, prefix + "_write_latency_seconds", labels(c), c.write_latency);
+    }
+
+  }
+
+  // Prometheus text exposition of a server's metrics, per connection series are optional
+  // since a busy server has many of them
+  inline void write_prometheus(std::ostream& os, const server_metrics_snapshot& m, bool per_connection = false, const std::string& prefix = "netron_server")
+  {
+    struct { const char* name; const char* type; const char* help; uint64_t value; } values[] = {
+      { "_connections_accepted_total", "counter", "Connections accepted.", m.connections_accepted },
+      { "_connections_rejected_total", "counter", "Connections rejected.", m.connections_rejected },
+      { "_accept_errors_total", "counter", "Failed accepts.", m.accept_errors },
+      { "_connections", "gauge", "Connections held by the server.", m.connection_count },
+      { "_pending_connections", "gauge", "Connections in their handshake.", m.pending_connections },
+      { "_incoming_queue_depth", "gauge", "Messages waiting for update.", m.incoming_queue_depth },
+    };
+
+    for (auto& value : values)
+    {
+      prometheus::write_metric(os, prefix + value.name, value.type, value.help);
+      os << prefix << value.name << ' ' << value.value << '\n';
+    }
+
+    prometheus::write_connections(os, prefix, { m.totals }, false);
+
+    if (per_connection)
+      prometheus::write_connections(os, prefix + "_connection", m.connections, true);
+  }
+
+  inline void write_prometheus(std::ostream& os, const client_metrics_snapshot& m, const std::string& prefix = "netron_client")
+  {
+    prometheus::write_metric(os, prefix + "_connect_failures_total", "counter", "Failed connection attempts.");
+    os << prefix << "_connect_failures_total " << m.connect_failures << '\n';
+    prometheus::write_metric(os, prefix + "_reconnects_total", "counter", "Connections re-established after a loss.");
+    os << prefix << "_reconnects_total " << m.reconnects << '\n';
+    prometheus::write_metric(os, prefix + "_late_replies_total", "counter", "Replies dropped because their call had already ended.");
+    os << prefix << "_late_replies_total " << m.late_replies << '\n';
+    prometheus::write_metric(os, prefix + "_incoming_queue_depth", "gauge", "Messages waiting in incoming.");
+    os << prefix << "_incoming_queue_depth " << m.incoming_queue_depth << '\n';
+
+    prometheus::write_connections(os, prefix, { m.totals }, false);
+  }
+
+  // Write the exposition to a file for a textfile collector. It is written next to the target and
+  // renamed over it, so a scrape never sees a partial file.
+  template<typename Snapshot, typename... Args>
+  bool write_prometheus_file(const std::string& path, const Snapshot& m, Args&&... args)
+  {
+    const std::string temporary = path + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::trunc);
+      if (!file)
+        return false;
+
+      write_prometheus(file, m, std::forward<Args>(args)...);
+      if (!file.flush())
+        return false;
+    }
+
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+  }
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <netron/common.hpp>
+
+namespace netron
+{
+
+  // Unbounded queue that any number of threads push to without taking a lock, while one thread at a
+  // time pops. A push is a node allocation and a single atomic exchange. A pop may briefly miss an
+  // item whose push has not finished yet, empty() already counts it.
+  template<typename T>
+  class mpsc_queue
+  {
+  public:
+    mpsc_queue()
+      : m_head(new node()), m_tail(m_head.load())
+    {}
+
+    mpsc_queue(const mpsc_queue<T>&) = delete;
+    mpsc_queue<T>& operator=(const mpsc_queue<T>&) = delete;
+
+    ~mpsc_queue()
+    {
+      while (m_tail)
+      {
+        node* next = m_tail->next.load(std::memory_order_relaxed);
+        delete m_tail;
+        m_tail = next;
+      }
+    }
+
+    // Adds an item to the back of the queue, from any thread
+    void push(T item)
+    {
+      node* added = new node(std::move(item));
+      node* previous = m_head.exchange(added);
+      previous->next.store(added, std::memory_order_release);
+    }
+
+    // Moves the front item out of the queue, returns false if there is none. Consumer only.
+    bool pop(T& item)
+    {
+      node* next = m_tail->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+
+      // The popped item's node becomes the empty node in front of the queue
+      item = std::move(next->item);
+      delete m_tail;
+      m_tail = next;
+      return true;
+    }
+
+    // Returns true if everything pushed so far has been popped. Consumer only.
+    bool empty() const
+    {
+      return m_head.load() == m_tail;
+    }
+
+  private:
+    struct node
+    {
+      node() = default;
+      explicit node(T&& item) : item(std::move(item)) {}
+
+      T item{};
+      std::atomic<node*> next{ nullptr };
+    };
+
+    // Producers swap themselves in at the head, the consumer follows the links from the tail
+    std::atomic<node*> m_head;
+    node* m_tail;
+  };
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <netron/common.hpp>
+#include <netron/asio.hpp>
+
+#if !defined(_WIN32)
+  #define NETRON_HAS_FILE_PAYLOAD 1
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#if defined(__linux__)
+  #include <sys/sendfile.h>
+#endif
+
+namespace netron
+{
+
+  // Bytes sent after the body of a message without ever being copied into it, either a region of
+  // memory such as a mapped file, or a range of an open file. The remote end receives an ordinary
+  // message whose body is the original body followed by these bytes.
+  class payload
+  {
+  public:
+    payload() = default;
+
+    // A region of memory, the owner keeps it valid until the message has been written
+    static payload from_memory(std::shared_ptr<const void> owner, const void* data, size_t size)
+    {
+      payload p;
+      p.m_owner = std::move(owner);
+      p.m_data = static_cast<const uint8_t*>(data);
+      p.m_size = size;
+      return p;
+    }
+
+#ifdef NETRON_HAS_FILE_PAYLOAD
+    // size bytes of an open file starting at offset, the descriptor is duplicated so the caller
+    // may close theirs right away. Throws std::system_error if it cannot be.
+    static payload from_file(int fd, uint64_t offset, uint64_t size)
+    {
+      const int duplicate = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+      if (duplicate < 0)
+        throw std::system_error(errno, std::generic_category(), "Failed to duplicate file descriptor");
+
+      payload p;
+      p.m_file = std::make_shared<file_handle>(duplicate);
+      p.m_offset = offset;
+      p.m_size = size;
+      return p;
+    }
+
+    // The whole file at path. Throws std::system_error if it cannot be opened.
+    static payload from_file(const std::string& path)
+    {
+      const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+
+      payload p;
+      p.m_file = std::make_shared<file_handle>(fd);
+
+      struct stat status;
+      if (::fstat(fd, &status) != 0)
+        throw std::system_error(errno, std::generic_category(), "Failed to stat " + path);
+      p.m_size = uint64_t(status.st_size);
+      return p;
+    }
+#endif
+
+    uint64_t size() const
+    {
+      return m_size;
+    }
+
+    bool empty() const
+    {
+      return m_size == 0;
+    }
+
+    bool is_file() const
+    {
+      return m_file != nullptr;
+    }
+
+    // The memory of a region payload
+    asio::const_buffer buffer() const
+    {
+      return asio::buffer(m_data, size_t(m_size));
+    }
+
+    // Copy size bytes from offset on, files are read with pread. Returns the bytes copied, fewer
+    // than asked for only if a file ended early or failed, in which case ec says why.
+    size_t read(uint64_t offset, uint8_t* out, size_t size, asio::error_code& ec) const
+    {
+      if (!is_file())
+      {
+        std::memcpy(out, m_data + offset, size);
+        return size;
+      }
+
+#ifdef NETRON_HAS_FILE_PAYLOAD
+      size_t done = 0;
+      while (done < size)
+      {
+        const ssize_t n = ::pread(m_file->fd, out + done, size - done, off_t(m_offset + offset + done));
+        if (n > 0)
+          done += size_t(n);
+        else if (n < 0 && errno == EINTR)
+          continue;
+        else
+        {
+          ec = n == 0 ? asio::error_code(asio::error::eof) : asio::error_code(errno, asio::error::get_system_category());
+          break;
+        }
+      }
+      return done;
+#else
+      ec = asio::error::operation_not_supported;
+      return 0;
+#endif
+    }
+
+#if defined(__linux__)
+    // Let the kernel copy up to max bytes of a file payload from offset on straight into a
+    // non-blocking socket. Returns the bytes written, ec is would_block once the socket is full.
+    uint64_t send_file(int socket, uint64_t offset, uint64_t max, asio::error_code& ec) const
+    {
+      uint64_t done = 0;
+      while (done < max)
+      {
+        off_t position = off_t(m_offset + offset + done);
+        const ssize_t n = ::sendfile(socket, m_file->fd, &position, size_t(std::min<uint64_t>(max - done, 1u << 30)));
+        if (n > 0)
+          done += uint64_t(n);
+        else if (n < 0 && errno == EINTR)
+          continue;
+        else
+        {
+          ec = n == 0 ? asio::error_code(asio::error::eof) : asio::error_code(errno, asio::error::get_system_category());
+          break;
+        }
+      }
+      return done;
+    }
+#endif
+
+  private:
+#ifdef NETRON_HAS_FILE_PAYLOAD
+    struct file_handle
+    {
+      explicit file_handle(int fd) : fd(fd) {}
+      ~file_handle() { ::close(fd); }
+      file_handle(const file_handle&) = delete;
+      file_handle& operator=(const file_handle&) = delete;
+
+      int fd;
+    };
+#else
+    struct file_handle {};
+#endif
+
+    std::shared_ptr<const void> m_owner;
+    const uint8_t* m_data = nullptr;
+    std::shared_ptr<file_handle> m_file;
+    uint64_t m_offset = 0;
+    uint64_t m_size = 0;
+  };
+
+}
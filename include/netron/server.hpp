@@ -2,11 +2,17 @@
 
 #include <netron/common.hpp>
 #include <netron/asio.hpp>
+#include <netron/log.hpp>
 #include <netron/tsqueue.hpp>
+#include <netron/token_bucket.hpp>
 #include <netron/message.hpp>
 #include <netron/connection.hpp>
 #include <netron/config.hpp>
 
+#if defined(ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+  #include <sys/stat.h>
+#endif
+
 namespace netron 
 {
 
@@ -18,84 +24,173 @@ namespace netron
     using Message = message<T>;
 
     server_interface(uint16_t port, config cfg = config{})
-      : m_asio_acceptor(m_asio_context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)), m_config(cfg)
+      : m_config(cfg)
     {
+#ifdef SO_REUSEPORT
+      const uint32_t acceptor_count = std::max(1u, m_config.acceptor_count);
+#else
+      const uint32_t acceptor_count = 1;
+#endif
+
+      listen(asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port), acceptor_count);
 
+      // Datagrams of all connections arrive on one UDP socket with the TCP port's number
+      if (m_config.udp)
+      {
+        const auto local = to_tcp(m_shards.front()->acceptor.local_endpoint());
+        m_udp_channel = std::make_shared<udp_channel>(m_shards.front()->context, asio::ip::udp::endpoint(asio::ip::udp::v4(), local.port()));
+      }
+    }
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    // Listen on a Unix domain socket instead of a TCP port, for clients on the same host. A socket
+    // left at the path by a previous run is replaced, the socket file is removed again on destruction.
+    // Other files and sockets still being listened on are kept and the bind fails, on Windows the
+    // path is never touched. The TCP socket options of the config do not apply, there is a single acceptor.
+    server_interface(const asio::local::stream_protocol::endpoint& endpoint, config cfg = config{})
+      : m_config(cfg), m_local_path(endpoint.path())
+    {
+      remove_stale_socket(endpoint);
+      listen(endpoint, 1);
+      m_local_file = local_file_id();
     }
+#endif
 
     virtual ~server_interface()
     {
+      m_messages_in.set_notifier(nullptr);
       stop();
+
+      // Queued messages hold their connections, which must go before the shards' contexts
+      m_messages_in.clear();
+      m_backlogs.clear();
+      m_backlog_turns.clear();
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+      // Another server may have replaced the socket file meanwhile, it is left alone
+      if (!m_local_path.empty() && m_local_file != std::pair<uint64_t, uint64_t>() && local_file_id() == m_local_file)
+        std::remove(m_local_path.c_str());
+#endif
     }
 
     bool start()
     {
       try
       {
-        wait_for_client_connection();
+        if (m_udp_channel)
+        {
+          m_udp_channel->start_receiving(
+            [this](const datagram_header& header, const uint8_t* data, size_t size, const asio::ip::udp::endpoint& from)
+            {
+              route_datagram(header, data, size, from);
+            }
+          );
+        }
 
-        m_thread_context = std::thread([this]() { m_asio_context.run(); });
+        for (auto& s : m_shards)
+        {
+          wait_for_client_connection(*s);
+
+          auto& context = s->context;
+          s->thread = std::thread([&context]() { context.run(); });
+        }
       }
       catch(std::exception& e)
       {
-        std::cerr << "Server Exception: " << e.what() << '\n';
+        NETRON_LOG_ERROR("Server Exception: " << e.what());
         return false;
       }
 
-      std::cout << "Server Started!\n";
+      NETRON_LOG_INFO("Server Started!");
       return true;
     }
 
     void stop()
     {
-      // Request the context to close
-      m_asio_context.stop();
+      // Request the contexts to close
+      for (auto& s : m_shards)
+        s->context.stop();
 
-      // Tidy up the context thread
-      if (m_thread_context.joinable())
-        m_thread_context.join();
+      // Tidy up the context threads
+      for (auto& s : m_shards)
+        if (s->thread.joinable())
+          s->thread.join();
 
-      std::cout << "Server Stopped!\n";
+      NETRON_LOG_INFO("Server Stopped!");
     }
 
-    // (ASYNC) Instruct asio to wait for a connection
-    void wait_for_client_connection()
+    // Stop gracefully: accepting stops, every connection gets up to drain_timeout to write out the
+    // messages sent to it before it is half-closed and the client closes its end, then the server
+    // stops as with stop(). Returns the number of messages dropped because they were not written
+    // in time. Messages received meanwhile are left for update(). The drains run on the I/O threads,
+    // so this cannot be called from one of them, e.g. from on_client_disconnect.
+    size_t stop(std::chrono::milliseconds drain_timeout)
     {
-      m_asio_acceptor.async_accept(
-        [this](std::error_code ec, asio::ip::tcp::socket socket)
-        {
-          if (!ec)
-          {
-            std::cout << "New Connection: " << socket.remote_endpoint() << '\n';
+      for (auto& s : m_shards)
+        if (s->context.get_executor().running_in_this_thread())
+          throw std::runtime_error("A graceful stop cannot wait on one of the server's own I/O threads");
 
-            auto new_connection = std::make_shared<connection<T>>(
-              connection<T>::owner::server, 
-              m_asio_context, 
-              std::move(socket), 
-              m_messages_in, 
-              m_config
-            );
-          
-            if (m_connections.size() < m_config.max_connections && on_client_connect(new_connection))
+      struct drain_state
+      {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = 0;
+        size_t dropped = 0;
+      };
+      auto state = std::make_shared<drain_state>();
+
+      // Without the context threads nothing would be written
+      bool is_running = !m_shards.empty();
+      for (auto& s : m_shards)
+        is_running = is_running && s->thread.joinable();
+
+      if (is_running)
+      {
+        std::vector<Client> clients;
+        for (auto& s : m_shards)
+        {
+          shard* accepting = s.get();
+          asio::post(s->context,
+            [accepting]()
             {
-              m_connections.push_back(std::move(new_connection));
-              m_connections.back()->connect_to_client(this, m_id_counter++);
-              std::cout << "[" << m_connections.back()->get_id() << "] Connection Approved" << '\n';
+              asio::error_code ec;
+              accepting->acceptor.close(ec);
+              accepting->accept_timer.cancel();
             }
-            else
+          );
+
+          std::lock_guard<std::mutex> lock(s->mutex);
+          for (auto& client : s->connections)
+            if (client && client->is_connected())
+              clients.push_back(client);
+        }
+
+        state->remaining = clients.size();
+        for (auto& client : clients)
+        {
+          client->shutdown(drain_timeout,
+            [state](size_t dropped)
             {
-              std::cout << "Rejected Connection.\n";
+              std::lock_guard<std::mutex> lock(state->mutex);
+              state->dropped += dropped;
+              if (--state->remaining == 0)
+                state->done.notify_all();
             }
-          }
-          else
-          {
-            std::cerr << "New Connection Error: " << ec.message() << '\n';
-          }
-
-          // Wait for another connection
-          wait_for_client_connection();
+          );
         }
-      );
+
+        // Every drain ends at its deadline, the slack leaves time for the close that follows
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (!state->done.wait_for(lock, drain_timeout + std::chrono::seconds(1), [&state]() { return state->remaining == 0; }))
+          NETRON_LOG_WARNING("Shutdown Timed Out With " << state->remaining << " Connections Draining");
+      }
+
+      stop();
+
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->dropped > 0)
+        NETRON_LOG_WARNING("Shutdown Dropped " << state->dropped << " Messages");
+      return state->dropped;
     }
 
     // Send a message to a specific client
@@ -108,49 +203,70 @@ namespace netron
       else
       {
         on_client_disconnect(client);
-        client.reset();
-        m_connections.erase(
-          std::remove(m_connections.begin(), m_connections.end(), client), m_connections.end()
-        );
+        for (auto& s : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(s->mutex);
+          auto it = std::find(s->connections.begin(), s->connections.end(), client);
+          if (it != s->connections.end())
+          {
+            retire_client(*it);
+            s->connections.erase(it);
+          }
+        }
       }
     }
 
+    // Reply to a request made with client_interface::call
+    void reply(Client client, const Message& request, Message response)
+    {
+      response.header.correlation_id = request.header.correlation_id;
+      response.header.is_reply = true;
+      message_client(client, response);
+    }
+
     // Send a message to all clients
     void message_all_clients(const Message& msg, Client ignore_client = nullptr)
     {
-      bool does_invalid_client_exist = false;
-      for (auto& client : m_connections)
+      std::vector<Client> invalid_clients;
+      for (auto& s : m_shards)
       {
-        if (client && client->is_connected())
-        {
-          if (client != ignore_client)
-            client->send(msg);
-        }
-        else
+        std::lock_guard<std::mutex> lock(s->mutex);
+        for (auto& client : s->connections)
         {
-          on_client_disconnect(client);
-          client.reset();
-          does_invalid_client_exist = true;
+          if (client && client->is_connected())
+          {
+            if (client != ignore_client)
+              client->send(msg);
+          }
+          else
+          {
+            retire_client(client);
+            invalid_clients.push_back(std::move(client));
+          }
         }
+
+        if (!invalid_clients.empty())
+          s->connections.erase(
+            std::remove(s->connections.begin(), s->connections.end(), nullptr), s->connections.end()
+          );
       }
 
-      if (does_invalid_client_exist)
-        m_connections.erase(
-          std::remove(m_connections.begin(), m_connections.end(), nullptr), m_connections.end()
-        );
+      // Notify outside of the locks, the handler may message clients itself
+      for (auto& client : invalid_clients)
+        on_client_disconnect(client);
     }
 
+    // Pass up to max_messages received messages to on_message. Connections with messages waiting
+    // take turns, one message each, so a flooding client cannot hold up the others.
     void update(size_t max_messages = std::numeric_limits<size_t>::max(), bool wait = false)
     {
-      if (wait)
+      if (wait && backlog_count() == 0)
         m_messages_in.wait();
 
       size_t message_count = 0;
-      while (message_count < max_messages && !m_messages_in.empty())
+      owned_message<T> msg;
+      while (message_count < max_messages && next_message(msg))
       {
-        // Grab the front message
-        auto msg = m_messages_in.pop_front();
-
         // Pass to message handler
         on_message(msg.remote, msg.msg);
 
@@ -158,6 +274,56 @@ namespace netron
       }
     }
 
+    // Snapshot of the server's counters, cheap enough to take periodically. Per connection
+    // snapshots are only collected on request.
+    server_metrics_snapshot metrics(bool per_connection = false)
+    {
+      server_metrics_snapshot snapshot;
+      snapshot.connections_accepted = m_connections_accepted.load(std::memory_order_relaxed);
+      snapshot.connections_rejected = m_connections_rejected.load(std::memory_order_relaxed);
+      snapshot.accept_errors = m_accept_errors.load(std::memory_order_relaxed);
+      snapshot.pending_connections = m_pending_connections;
+      snapshot.incoming_queue_depth = m_messages_in.count() + backlog_count();
+      snapshot.totals = m_retired_metrics.snapshot();
+
+      for (auto& s : m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        for (auto& client : s->connections)
+        {
+          if (!client)
+            continue;
+
+          auto c = client->get_metrics();
+          snapshot.totals += c;
+          snapshot.connection_count++;
+          if (per_connection)
+            snapshot.connections.push_back(c);
+        }
+      }
+
+      return snapshot;
+    }
+
+    // Instead of polling update(), have on_message called on the executor as soon as messages
+    // arrive. The executor must not run handlers after the server has been destroyed.
+    template<typename Executor>
+    void dispatch_messages(const Executor& executor)
+    {
+      m_messages_in.set_notifier(
+        [this, executor]()
+        {
+          asio::post(executor, [this]() { update(); });
+        }
+      );
+    }
+
+    // Go back to polling update()
+    void stop_dispatching_messages()
+    {
+      m_messages_in.set_notifier(nullptr);
+    }
+
   protected:
     // Called when a client connects, has an option to reject the connection
     virtual bool on_client_connect(Client client)
@@ -196,27 +362,374 @@ namespace netron
 
     }
 
+    // Called when a client has left the handshake stage, either validated or dropped
+    void release_pending_connection()
+    {
+      m_pending_connections--;
+
+      // Wake up acceptors that stopped because of too many pending connections
+      for (auto& s : m_shards)
+      {
+        if (s->is_accept_paused.exchange(false))
+        {
+          shard& paused = *s;
+          asio::post(paused.context, [this, &paused]() { wait_for_client_connection(paused); });
+        }
+      }
+    }
+
+    // Called by a connection that negotiated UDP, its datagrams are routed to it by key from now on.
+    // Returns the server's UDP channel.
+    std::shared_ptr<udp_channel> register_datagram_connection(Client client)
+    {
+      std::lock_guard<std::mutex> lock(m_udp_mutex);
+
+      // Entries of connections that are gone are swept whenever the map has doubled
+      if (m_udp_connections.size() >= m_udp_sweep_size)
+      {
+        for (auto it = m_udp_connections.begin(); it != m_udp_connections.end();)
+          it = it->second.expired() ? m_udp_connections.erase(it) : std::next(it);
+        m_udp_sweep_size = std::max<size_t>(64, 2 * m_udp_connections.size());
+      }
+
+      m_udp_connections[client->get_datagram_key()] = client;
+      return m_udp_channel;
+    }
+
+    // (ASYNC) Accept a connection from a client of this process, see client_interface::connect_in_process.
+    // The connection is placed on one of the shards and its messages never touch a socket.
+    void accept_in_process(Client client)
+    {
+      shard& s = *m_shards[m_id_counter % m_shards.size()];
+      asio::post(s.context,
+        [this, &s, client]()
+        {
+          auto new_connection = std::make_shared<connection<T>>(
+            connection<T>::owner::server,
+            s.context,
+            stream_protocol::socket(s.context),
+            m_messages_in,
+            m_config
+          );
+
+          if (connection_count() < m_config.max_connections && on_client_connect(new_connection))
+          {
+            {
+              std::lock_guard<std::mutex> lock(s.mutex);
+              s.connections.push_back(new_connection);
+            }
+            m_connections_accepted.fetch_add(1, std::memory_order_relaxed);
+            new_connection->connect_to_client_in_process(this, m_id_counter++, client);
+            NETRON_LOG_INFO("[" << new_connection->get_id() << "] Connection Approved (in-process)");
+          }
+          else
+          {
+            m_connections_rejected.fetch_add(1, std::memory_order_relaxed);
+            NETRON_LOG_INFO("Rejected Connection.");
+            client->reject_in_process(asio::error::connection_refused);
+          }
+        }
+      );
+    }
+
+  protected:
+    // Each acceptor runs on its own context and thread and owns the connections it accepted
+    struct shard
+    {
+      shard()
+        : acceptor(context), accept_timer(context)
+      {}
+
+      // Asio context handles the data transfer
+      asio::io_context context;
+
+      // Thread for asio context
+      std::thread thread;
+
+      // Asio acceptor
+      asio::basic_socket_acceptor<stream_protocol> acceptor;
+
+      // Container of this shard's connections, guarded by the mutex
+      std::deque<Client> connections;
+      std::mutex mutex;
+
+      // Accepting stopped because of too many pending connections
+      std::atomic<bool> is_accept_paused{ false };
+
+      // Delays the next accept when throttled or after an accept error
+      asio::steady_timer accept_timer;
+
+      // Accept rate limit
+      token_bucket accept_bucket;
+    };
+
+    // Open the acceptors of the shards. Every acceptor binds the same endpoint, with more than one
+    // the kernel load-balances new connections between them.
+    void listen(const stream_protocol::endpoint& endpoint, uint32_t acceptor_count)
+    {
+      for (uint32_t i = 0; i < acceptor_count; ++i)
+      {
+        m_shards.push_back(std::make_unique<shard>());
+        auto& acceptor = m_shards.back()->acceptor;
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (acceptor_count > 1)
+          acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+        acceptor.bind(endpoint);
+        acceptor.listen();
+
+        // The accept rate is split evenly between the acceptors
+        if (m_config.max_accept_rate != std::numeric_limits<uint32_t>::max())
+          m_shards.back()->accept_bucket = token_bucket((m_config.max_accept_rate + acceptor_count - 1) / acceptor_count);
+      }
+    }
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    // Remove a socket file nobody listens on anymore, a connect to it is refused
+    static void remove_stale_socket(const asio::local::stream_protocol::endpoint& endpoint)
+    {
+#if !defined(_WIN32)
+      struct stat status;
+      if (::lstat(endpoint.path().c_str(), &status) != 0 || !S_ISSOCK(status.st_mode))
+        return;
+
+      asio::io_context context;
+      asio::local::stream_protocol::socket probe(context);
+      asio::error_code ec;
+      probe.connect(endpoint, ec);
+      if (ec == asio::error::connection_refused)
+        std::remove(endpoint.path().c_str());
+#endif
+    }
+
+    // Device and inode of the file at the socket path, zero if there is none or they are unknown
+    std::pair<uint64_t, uint64_t> local_file_id() const
+    {
+#if !defined(_WIN32)
+      struct stat status;
+      if (::lstat(m_local_path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+        return { uint64_t(status.st_dev), uint64_t(status.st_ino) };
+#endif
+      return {};
+    }
+#endif
+
+    // (ASYNC) Instruct asio to wait for a connection
+    void wait_for_client_connection(shard& s)
+    {
+      // Too many connections are still in the handshake, resume once one of them finishes.
+      // New connections wait in the kernel's backlog meanwhile.
+      if (m_pending_connections >= m_config.max_pending_connections)
+      {
+        s.is_accept_paused = true;
+
+        // A handshake may have finished in the meantime, nobody would resume this acceptor then
+        if (m_pending_connections >= m_config.max_pending_connections || !s.is_accept_paused.exchange(false))
+          return;
+      }
+
+      // Accept rate exceeded, resume once the bucket has a token again
+      const auto delay = take_accept_token(s);
+      if (delay.count() > 0)
+      {
+        wait_for_client_connection_after(s, delay);
+        return;
+      }
+
+      s.acceptor.async_accept(
+        [this, &s](std::error_code ec, stream_protocol::socket socket)
+        {
+          if (!ec)
+          {
+            asio::error_code endpoint_ec;
+            NETRON_LOG_INFO("New Connection: " << to_string(socket.remote_endpoint(endpoint_ec)));
+
+            auto new_connection = std::make_shared<connection<T>>(
+              connection<T>::owner::server, 
+              s.context, 
+              std::move(socket), 
+              m_messages_in, 
+              m_config
+            );
+          
+            if (connection_count() < m_config.max_connections && on_client_connect(new_connection))
+            {
+              m_pending_connections++;
+              {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.connections.push_back(new_connection);
+              }
+              m_connections_accepted.fetch_add(1, std::memory_order_relaxed);
+              new_connection->connect_to_client(this, m_id_counter++);
+              NETRON_LOG_INFO("[" << new_connection->get_id() << "] Connection Approved");
+            }
+            else
+            {
+              m_connections_rejected.fetch_add(1, std::memory_order_relaxed);
+              NETRON_LOG_INFO("Rejected Connection.");
+            }
+          }
+          else
+          {
+            NETRON_LOG_WARNING("New Connection Error: " << ec.message());
+            if (ec != asio::error::operation_aborted)
+              m_accept_errors.fetch_add(1, std::memory_order_relaxed);
+
+            // Errors like running out of file descriptors persist for a while, do not spin on them
+            if (ec != asio::error::operation_aborted)
+              wait_for_client_connection_after(s, std::chrono::milliseconds(100));
+            return;
+          }
+
+          // Wait for another connection
+          wait_for_client_connection(s);
+        }
+      );
+    }
+
+    // Returns the number of connections in all shards
+    size_t connection_count()
+    {
+      size_t count = 0;
+      for (auto& s : m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        count += s->connections.size();
+      }
+      return count;
+    }
+
+  private:
+    // (ASYNC) Instruct asio to wait for a connection once the delay has passed
+    void wait_for_client_connection_after(shard& s, std::chrono::steady_clock::duration delay)
+    {
+      s.accept_timer.expires_after(delay);
+      s.accept_timer.async_wait(
+        [this, &s](std::error_code ec)
+        {
+          if (!ec)
+            wait_for_client_connection(s);
+        }
+      );
+    }
+
+    // Keep the counters of a connection the server lets go of, called under the shard's lock
+    void retire_client(const Client& client)
+    {
+      if (client)
+        m_retired_metrics.add(client->get_metrics());
+    }
+
+    // Hand a datagram to the connection whose key it carries, runs on the first shard's context
+    void route_datagram(const datagram_header& header, const uint8_t* data, size_t size, const asio::ip::udp::endpoint& from)
+    {
+      Client client;
+      {
+        std::lock_guard<std::mutex> lock(m_udp_mutex);
+        auto it = m_udp_connections.find(header.key);
+        if (it == m_udp_connections.end())
+          return;
+
+        client = it->second.lock();
+        if (!client)
+        {
+          m_udp_connections.erase(it);
+          return;
+        }
+      }
+
+      client->receive_datagram(header, std::vector<uint8_t>(data, data + size), from);
+    }
+
+    // Take the message of the connection whose turn it is, the messages that arrived meanwhile are
+    // sorted into their connections' backlogs first. Returns false if there is none.
+    bool next_message(owned_message<T>& msg)
+    {
+      std::lock_guard<std::mutex> lock(m_backlog_mutex);
+      while (!m_messages_in.empty())
+      {
+        auto in = m_messages_in.pop_front();
+        auto& backlog = m_backlogs[in.remote.get()];
+        if (backlog.empty())
+          m_backlog_turns.push_back(in.remote.get());
+        backlog.push_back(std::move(in));
+        m_backlog_count++;
+      }
+
+      if (m_backlog_turns.empty())
+        return false;
+
+      // The connection goes to the back of the line if it has more
+      auto remote = m_backlog_turns.front();
+      m_backlog_turns.pop_front();
+      auto backlog = m_backlogs.find(remote);
+      msg = std::move(backlog->second.front());
+      backlog->second.pop_front();
+      m_backlog_count--;
+
+      if (backlog->second.empty())
+        m_backlogs.erase(backlog);
+      else
+        m_backlog_turns.push_back(remote);
+      return true;
+    }
+
+    // Number of messages sorted into backlogs but not passed to on_message yet
+    size_t backlog_count()
+    {
+      std::lock_guard<std::mutex> lock(m_backlog_mutex);
+      return m_backlog_count;
+    }
+
+    // Takes a token from the accept rate bucket, returns how long to wait if it is empty
+    std::chrono::steady_clock::duration take_accept_token(shard& s)
+    {
+      const auto delay = s.accept_bucket.wait_time(1.0);
+      if (delay.count() == 0)
+        s.accept_bucket.take(1.0);
+      return delay;
+    }
+
   protected:
     // incoming messages from connected clients
     tsqueue<owned_message<T>> m_messages_in;
 
-    // Container of active validated connections
-    std::deque<Client> m_connections;
-
-    // Asio context handles the data transfer
-    asio::io_context m_asio_context;
+    // Received messages waiting for their connection's turn in update(), and the order of the turns
+    std::mutex m_backlog_mutex;
+    std::unordered_map<connection<T>*, std::deque<owned_message<T>>> m_backlogs;
+    std::deque<connection<T>*> m_backlog_turns;
+    size_t m_backlog_count = 0;
 
-    // Thread for asio context
-    std::thread m_thread_context;
+    // One acceptor, context and thread per shard
+    std::vector<std::unique_ptr<shard>> m_shards;
 
-    // Asio acceptor
-    asio::ip::tcp::acceptor m_asio_acceptor;
+    // Number of accepted connections that have not finished the handshake yet
+    std::atomic<uint32_t> m_pending_connections{ 0 };
 
     // Unique identifier for a client
-    uint32_t m_id_counter = 10000;
+    std::atomic<uint32_t> m_id_counter{ 10000 };
 
     // Server's configuration
     config m_config;
+
+    // Path of the Unix domain socket the server listens on, empty for TCP, and the file bound there
+    std::string m_local_path;
+    std::pair<uint64_t, uint64_t> m_local_file;
+
+    // UDP socket shared by the connections that negotiated it and the routing of datagrams by key.
+    // Declared after the shards, the channel must go before the context it runs on.
+    std::shared_ptr<udp_channel> m_udp_channel;
+    std::mutex m_udp_mutex;
+    std::unordered_map<uint64_t, std::weak_ptr<connection<T>>> m_udp_connections;
+    size_t m_udp_sweep_size = 64;
+
+    // Counters for metrics(), connections that are gone are folded into the retired totals
+    std::atomic<uint64_t> m_connections_accepted{ 0 };
+    std::atomic<uint64_t> m_connections_rejected{ 0 };
+    std::atomic<uint64_t> m_accept_errors{ 0 };
+    connection_metrics m_retired_metrics;
   };
 
 }
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <netron/common.hpp>
+#include <netron/asio.hpp>
+
+#if defined(__linux__)
+  #define NETRON_HAS_SHARED_MEMORY 1
+  #include <sys/mman.h>
+  #include <sys/eventfd.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace netron
+{
+
+#ifdef NETRON_HAS_SHARED_MEMORY
+
+  // Shared state of one direction, the writer and the reader each own a cache line
+  struct shared_ring_header
+  {
+    alignas(64) std::atomic<uint64_t> write_position;
+
+    // The writer found the ring full and waits for the reader to make room
+    std::atomic<uint32_t> is_writer_waiting;
+
+    alignas(64) std::atomic<uint64_t> read_position;
+
+    // The reader found the ring empty and sleeps on its eventfd
+    std::atomic<uint32_t> is_reader_sleeping;
+  };
+
+  // Single producer, single consumer byte ring in shared memory. Positions only grow, the
+  // capacity is a power of two so the offset of a position is the position masked.
+  class shared_ring
+  {
+  public:
+    shared_ring() = default;
+
+    shared_ring(void* memory, uint64_t capacity)
+      : m_header(static_cast<shared_ring_header*>(memory)),
+        m_data(static_cast<uint8_t*>(memory) + sizeof(shared_ring_header)),
+        m_capacity(capacity)
+    {}
+
+    uint64_t capacity() const
+    {
+      return m_capacity;
+    }
+
+    // (Writer) Bytes that can be written before the reader has to catch up
+    uint64_t writable() const
+    {
+      return m_capacity - (m_header->write_position.load(std::memory_order_relaxed) - m_header->read_position.load(std::memory_order_acquire));
+    }
+
+    // (Writer) Copy data behind the last committed byte, offset bytes in, refuses more than the ring holds
+    bool write(uint64_t offset, const void* data, size_t size)
+    {
+      return copy_in(m_header->write_position.load(std::memory_order_relaxed) + offset, data, size);
+    }
+
+    // (Writer) Make size written bytes visible to the reader
+    void commit(uint64_t size)
+    {
+      m_header->write_position.store(m_header->write_position.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+
+    // (Reader) Bytes committed by the writer and not consumed yet
+    uint64_t readable() const
+    {
+      return m_header->write_position.load(std::memory_order_acquire) - m_header->read_position.load(std::memory_order_relaxed);
+    }
+
+    // (Reader) Copy data out, offset bytes behind the first unconsumed byte, refuses more than the ring holds
+    bool read(uint64_t offset, void* data, size_t size) const
+    {
+      return copy_out(m_header->read_position.load(std::memory_order_relaxed) + offset, data, size);
+    }
+
+    // (Reader) Hand size bytes back to the writer
+    void consume(uint64_t size)
+    {
+      m_header->read_position.store(m_header->read_position.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+
+    shared_ring_header& header()
+    {
+      return *m_header;
+    }
+
+  private:
+    bool copy_in(uint64_t position, const void* data, size_t size)
+    {
+      if (size > m_capacity)
+        return false;
+
+      const uint64_t offset = position & (m_capacity - 1);
+      const size_t first = size_t(std::min<uint64_t>(size, m_capacity - offset));
+      std::memcpy(m_data + offset, data, first);
+      std::memcpy(m_data, static_cast<const uint8_t*>(data) + first, size - first);
+      return true;
+    }
+
+    bool copy_out(uint64_t position, void* data, size_t size) const
+    {
+      if (size > m_capacity)
+        return false;
+
+      const uint64_t offset = position & (m_capacity - 1);
+      const size_t first = size_t(std::min<uint64_t>(size, m_capacity - offset));
+      std::memcpy(data, m_data + offset, first);
+      std::memcpy(static_cast<uint8_t*>(data) + first, m_data, size - first);
+      return true;
+    }
+
+  private:
+    shared_ring_header* m_header = nullptr;
+    uint8_t* m_data = nullptr;
+    uint64_t m_capacity = 0;
+  };
+
+  // A memfd segment with one ring per direction and an eventfd per end to wake it up. The server
+  // creates it and passes the descriptors to the client over their Unix domain socket.
+  class shared_memory_channel
+  {
+  public:
+    shared_memory_channel(bool is_server)
+      : m_is_server(is_server)
+    {}
+
+    ~shared_memory_channel()
+    {
+      if (m_memory != MAP_FAILED)
+        ::munmap(m_memory, m_size);
+      for (int fd : { m_memory_fd, m_event_fds[0], m_event_fds[1] })
+        if (fd >= 0)
+          ::close(fd);
+    }
+
+    shared_memory_channel(const shared_memory_channel&) = delete;
+    shared_memory_channel& operator=(const shared_memory_channel&) = delete;
+
+    // (Server) Create the segment with rings of at least the given capacity
+    bool create(uint64_t capacity, asio::error_code& ec)
+    {
+      uint64_t rounded = 4096;
+      while (rounded < capacity)
+        rounded <<= 1;
+      m_capacity = rounded;
+
+      m_memory_fd = ::memfd_create("netron", MFD_CLOEXEC);
+      m_event_fds[0] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      m_event_fds[1] = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (m_memory_fd < 0 || m_event_fds[0] < 0 || m_event_fds[1] < 0 || ::ftruncate(m_memory_fd, off_t(segment_size())) != 0)
+      {
+        ec = asio::error_code(errno, asio::error::get_system_category());
+        return false;
+      }
+
+      return map(ec);
+    }
+
+    // (Server) Pass the descriptors and the ring capacity, fails with would_block until the socket is writable
+    bool send_descriptors(int socket, asio::error_code& ec)
+    {
+      int fds[3] = { m_memory_fd, m_event_fds[0], m_event_fds[1] };
+      char control[CMSG_SPACE(sizeof(fds))] = {};
+      uint64_t capacity = m_capacity;
+      iovec io = { &capacity, sizeof(capacity) };
+
+      msghdr msg = {};
+      msg.msg_iov = &io;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+      std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+      if (::sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != ssize_t(sizeof(capacity)))
+      {
+        ec = asio::error_code(errno, asio::error::get_system_category());
+        return false;
+      }
+
+      // The client holds its own references now
+      ::close(m_memory_fd);
+      m_memory_fd = -1;
+      return true;
+    }
+
+    // (Client) Take the descriptors sent by the server and map the segment, fails with would_block
+    // until they have arrived
+    bool receive_descriptors(int socket, asio::error_code& ec)
+    {
+      int fds[3] = { -1, -1, -1 };
+      char control[CMSG_SPACE(sizeof(fds))] = {};
+      uint64_t capacity = 0;
+      iovec io = { &capacity, sizeof(capacity) };
+
+      msghdr msg = {};
+      msg.msg_iov = &io;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      const ssize_t received = ::recvmsg(socket, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+      if (received <= 0)
+      {
+        ec = received == 0 ? asio::error_code(asio::error::eof) : asio::error_code(errno, asio::error::get_system_category());
+        return false;
+      }
+
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+      m_memory_fd = fds[0];
+      m_event_fds[0] = fds[1];
+      m_event_fds[1] = fds[2];
+      m_capacity = capacity;
+
+      // The capacity has to be a power of two the ring can mask positions with
+      if (received != ssize_t(sizeof(capacity)) || fds[2] < 0 || capacity < 4096 || (capacity & (capacity - 1)) != 0)
+      {
+        ec = asio::error::invalid_argument;
+        return false;
+      }
+
+      // Touching pages past the end of the file would raise SIGBUS
+      struct stat status;
+      if (::fstat(m_memory_fd, &status) != 0 || uint64_t(status.st_size) < segment_size())
+      {
+        ec = asio::error::invalid_argument;
+        return false;
+      }
+
+      if (!map(ec))
+        return false;
+
+      ::close(m_memory_fd);
+      m_memory_fd = -1;
+      return true;
+    }
+
+    // Ring this end writes to
+    shared_ring& outgoing()
+    {
+      return m_rings[m_is_server ? 0 : 1];
+    }
+
+    // Ring this end reads from
+    shared_ring& incoming()
+    {
+      return m_rings[m_is_server ? 1 : 0];
+    }
+
+    // Eventfd this end sleeps on, the caller takes ownership
+    int release_wait_handle()
+    {
+      int& fd = m_event_fds[m_is_server ? 1 : 0];
+      const int handle = fd;
+      fd = -1;
+      return handle;
+    }
+
+    // Wake the other end up, it is sleeping on its eventfd
+    void wake_peer()
+    {
+      const uint64_t one = 1;
+      const ssize_t written = ::write(m_event_fds[m_is_server ? 0 : 1], &one, sizeof(one));
+      (void)written;
+    }
+
+  private:
+    uint64_t ring_size() const
+    {
+      return sizeof(shared_ring_header) + m_capacity;
+    }
+
+    uint64_t segment_size() const
+    {
+      return 2 * ring_size();
+    }
+
+    bool map(asio::error_code& ec)
+    {
+      m_size = size_t(segment_size());
+      m_memory = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memory_fd, 0);
+      if (m_memory == MAP_FAILED)
+      {
+        ec = asio::error_code(errno, asio::error::get_system_category());
+        return false;
+      }
+
+      // A fresh memfd is zero filled, which is the initial state of both rings
+      m_rings[0] = shared_ring(m_memory, m_capacity);
+      m_rings[1] = shared_ring(static_cast<uint8_t*>(m_memory) + ring_size(), m_capacity);
+      return true;
+    }
+
+  private:
+    bool m_is_server;
+    int m_memory_fd = -1;
+    int m_event_fds[2] = { -1, -1 };
+    void* m_memory = MAP_FAILED;
+    size_t m_size = 0;
+    uint64_t m_capacity = 0;
+    shared_ring m_rings[2];
+  };
+
+#endif
+
+}
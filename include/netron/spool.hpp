@@ -0,0 +1,107 @@
+#pragma once
+
+#include <netron/common.hpp>
+#include <netron/asio.hpp>
+
+#if !defined(_WIN32)
+  #define NETRON_HAS_SPOOLING 1
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <stdlib.h>
+  #include <unistd.h>
+#endif
+
+namespace netron
+{
+
+  // A message body received into an unlinked, memory-mapped temporary file instead of the heap. The
+  // pages are backed by the file, so on a disk file system the kernel can write them out and drop them
+  // under pressure. On tmpfs, the usual /tmp, they are shared memory and only leave RAM through swap.
+  // Point $TMPDIR at a disk to keep large bodies out of memory.
+  class spooled_body
+  {
+  public:
+    spooled_body() = default;
+
+    ~spooled_body()
+    {
+#ifdef NETRON_HAS_SPOOLING
+      if (m_memory != MAP_FAILED)
+        ::munmap(m_memory, m_size);
+#endif
+    }
+
+    spooled_body(const spooled_body&) = delete;
+    spooled_body& operator=(const spooled_body&) = delete;
+
+    // Map a temporary file of size bytes, created in $TMPDIR or /tmp
+    bool open(size_t size, asio::error_code& ec)
+    {
+#ifdef NETRON_HAS_SPOOLING
+      const char* directory = std::getenv("TMPDIR");
+      std::string path = std::string(directory && *directory ? directory : "/tmp") + "/netron-spool-XXXXXX";
+
+      const int fd = ::mkstemp(&path[0]);
+      if (fd < 0)
+      {
+        ec = asio::error_code(errno, asio::error::get_system_category());
+        return false;
+      }
+
+      // Only the mapping refers to the file from here on, it is gone once unmapped
+      ::unlink(path.c_str());
+
+      // The blocks are reserved up front, a full disk fails here instead of with SIGBUS while receiving
+      const int error = ::posix_fallocate(fd, 0, off_t(size));
+      if (error != 0)
+        ec = asio::error_code(error, asio::error::get_system_category());
+      else
+      {
+        m_memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m_memory == MAP_FAILED)
+          ec = asio::error_code(errno, asio::error::get_system_category());
+      }
+      ::close(fd);
+
+      m_size = size;
+      return m_memory != MAP_FAILED;
+#else
+      ec = asio::error::operation_not_supported;
+      return false;
+#endif
+    }
+
+    const uint8_t* data() const
+    {
+      return static_cast<const uint8_t*>(m_memory);
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    // The mapping the body is received into
+    asio::mutable_buffer buffer()
+    {
+      return asio::buffer(m_memory, m_size);
+    }
+
+    // The body is complete, the mapping becomes read-only
+    void seal()
+    {
+#ifdef NETRON_HAS_SPOOLING
+      ::mprotect(m_memory, m_size, PROT_READ);
+#endif
+    }
+
+  private:
+#ifdef NETRON_HAS_SPOOLING
+    void* m_memory = MAP_FAILED;
+#else
+    void* m_memory = nullptr;
+#endif
+    size_t m_size = 0;
+  };
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <netron/common.hpp>
+
+namespace netron
+{
+
+  // Rate limit earning rate tokens per second, holding up to one second's worth and at least one.
+  // A default constructed bucket does not limit anything.
+  class token_bucket
+  {
+  public:
+    token_bucket() = default;
+
+    explicit token_bucket(double rate)
+      : m_rate(rate), m_tokens(std::max(1.0, rate)), m_refill_time(std::chrono::steady_clock::now())
+    {}
+
+    bool is_limited() const
+    {
+      return m_rate != std::numeric_limits<double>::infinity();
+    }
+
+    // Returns how long it takes until count tokens are available, zero if they are now
+    std::chrono::steady_clock::duration wait_time(double count)
+    {
+      if (!is_limited())
+        return std::chrono::steady_clock::duration::zero();
+
+      refill();
+      if (m_tokens >= count)
+        return std::chrono::steady_clock::duration::zero();
+
+      const double missing = (count - m_tokens) / std::max(1.0, m_rate);
+      return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(missing));
+    }
+
+    // Take count tokens, the bucket may be overdrawn and wait_time lets nobody through until the
+    // debt has been earned back
+    void take(double count)
+    {
+      if (is_limited())
+        m_tokens -= count;
+    }
+
+  private:
+    // Add the tokens earned since the last refill
+    void refill()
+    {
+      const auto now = std::chrono::steady_clock::now();
+      const double elapsed = std::chrono::duration<double>(now - m_refill_time).count();
+      m_tokens = std::min(std::max(1.0, m_rate), m_tokens + elapsed * m_rate);
+      m_refill_time = now;
+    }
+
+    double m_rate = std::numeric_limits<double>::infinity();
+    double m_tokens = 0.0;
+    std::chrono::steady_clock::time_point m_refill_time;
+  };
+
+}
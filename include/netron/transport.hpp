@@ -0,0 +1,86 @@
+#pragma once
+
+#include <netron/common.hpp>
+#include <netron/asio.hpp>
+
+namespace netron
+{
+
+  // Connections hold their socket through asio's generic stream protocol, so TCP and Unix domain
+  // sockets share the same message, handshake and config machinery
+  using stream_protocol = asio::generic::stream_protocol;
+
+  inline bool is_tcp(const stream_protocol::endpoint& endpoint)
+  {
+    const int family = endpoint.protocol().family();
+    return family == AF_INET || family == AF_INET6;
+  }
+
+  inline bool is_local(const stream_protocol::endpoint& endpoint)
+  {
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    return endpoint.protocol().family() == AF_UNIX;
+#else
+    return false;
+#endif
+  }
+
+  // The TCP address of an endpoint, check is_tcp first
+  inline asio::ip::tcp::endpoint to_tcp(const stream_protocol::endpoint& endpoint)
+  {
+    asio::ip::tcp::endpoint tcp;
+    std::memcpy(tcp.data(), endpoint.data(), endpoint.size());
+    tcp.resize(endpoint.size());
+    return tcp;
+  }
+
+  // Human readable address, "host:port" for TCP and "unix:path" for Unix domain sockets
+  inline std::string to_string(const stream_protocol::endpoint& endpoint)
+  {
+    std::ostringstream os;
+    if (is_tcp(endpoint))
+    {
+      os << to_tcp(endpoint);
+    }
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+    else if (endpoint.protocol().family() == AF_UNIX)
+    {
+      asio::local::stream_protocol::endpoint local;
+      std::memcpy(local.data(), endpoint.data(), endpoint.size());
+      local.resize(endpoint.size());
+      os << "unix:" << local.path();
+    }
+#endif
+    else
+    {
+      os << "family " << endpoint.protocol().family();
+    }
+    return os.str();
+  }
+
+  // Name of the backend asio waits for socket events with in this build
+  inline const char* io_backend()
+  {
+#if defined(ASIO_HAS_IO_URING) && defined(ASIO_DISABLE_EPOLL)
+    return "io_uring";
+#elif defined(ASIO_HAS_IOCP)
+    return "iocp";
+#elif defined(ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(ASIO_HAS_KQUEUE)
+    return "kqueue";
+#else
+    return "select";
+#endif
+  }
+
+  // Every address a TCP host name resolved to, in order
+  inline std::vector<stream_protocol::endpoint> to_endpoints(const asio::ip::tcp::resolver::results_type& results)
+  {
+    std::vector<stream_protocol::endpoint> endpoints;
+    for (const auto& entry : results)
+      endpoints.emplace_back(entry.endpoint());
+    return endpoints;
+  }
+
+}
@@ -3,6 +3,14 @@
 #include <netron/common.hpp>
 #include <netron/asio.hpp>
 
+#if defined(__linux__)
+  #include <sys/eventfd.h>
+  #include <unistd.h>
+#elif !defined(_WIN32)
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
 namespace netron
 {
 
@@ -12,7 +20,11 @@ namespace netron
   public:
     tsqueue() = default;
     tsqueue(const tsqueue<T>&) = delete;
-    virtual ~tsqueue() { clear(); }
+    virtual ~tsqueue()
+    {
+      clear();
+      close_notify_handle();
+    }
 
     // Returns and maintains item at front of queue
     const T& front()
@@ -28,24 +40,47 @@ namespace netron
       return m_queue.back();
     }
 
+    // Returns and maintains the item index places behind the front of the queue
+    const T& at(size_t index)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_queue[index];
+    }
+
     // Adds an item to the back of the queue
     void push_back(const T& item)
     {
-      std::lock_guard<std::mutex> lock(m_mutex);
-      m_queue.emplace_back(std::move(item));
+      std::function<void()> notifier;
+      int notify_fd = -1;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty())
+        {
+          notifier = m_notifier;
+          notify_fd = m_notify_fd[1];
+        }
+        m_queue.emplace_back(std::move(item));
+      }
 
-      std::unique_lock<std::mutex> blocking_lock(m_blocking_mutex);
-      m_blocking_cv.notify_one();
+      notify(notifier, notify_fd);
     }
 
     // Adds an item to the front of the queue
     void push_front(const T& item)
     {
-      std::lock_guard<std::mutex> lock(m_mutex);
-      m_queue.emplace_front(std::move(item));
+      std::function<void()> notifier;
+      int notify_fd = -1;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty())
+        {
+          notifier = m_notifier;
+          notify_fd = m_notify_fd[1];
+        }
+        m_queue.emplace_front(std::move(item));
+      }
 
-      std::unique_lock<std::mutex> blocking_lock(m_blocking_mutex);
-      m_blocking_cv.notify_one();
+      notify(notifier, notify_fd);
     }
 
     // Returns true if queue has no items
@@ -87,13 +122,111 @@ namespace netron
       return t;
     }
 
+    // Blocks until the queue has an item
     void wait()
     {
-      while (empty())
+      std::unique_lock<std::mutex> lock(m_blocking_mutex);
+      m_blocking_cv.wait(lock, [this]() { return !empty(); });
+    }
+
+    // The notifier is called on the pushing thread whenever the queue goes from empty to non-empty,
+    // the consumer is expected to drain the queue. Called at once if the queue already has items.
+    void set_notifier(std::function<void()> notifier)
+    {
+      bool is_pending;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_notifier = notifier;
+        is_pending = !m_queue.empty();
+      }
+
+      if (notifier && is_pending)
+        notifier();
+    }
+
+#if !defined(_WIN32)
+    // Returns a non-blocking descriptor (eventfd, or a pipe elsewhere) that becomes readable whenever
+    // the queue goes from empty to non-empty, for use with an external epoll/poll loop. Call
+    // clear_notify_handle before draining the queue, so items pushed meanwhile signal it again.
+    int notify_handle()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_notify_fd[0] == -1)
+      {
+#if defined(__linux__)
+        m_notify_fd[0] = m_notify_fd[1] = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        if (::pipe(m_notify_fd) == 0)
+        {
+          for (int fd : m_notify_fd)
+          {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+          }
+        }
+        else
+        {
+          m_notify_fd[0] = m_notify_fd[1] = -1;
+        }
+#endif
+        if (m_notify_fd[0] == -1)
+          throw std::runtime_error("Failed to create notify handle");
+
+        if (!m_queue.empty())
+          signal_notify_handle(m_notify_fd[1]);
+      }
+      return m_notify_fd[0];
+    }
+
+    // Resets the descriptor returned by notify_handle to not readable
+    void clear_notify_handle()
+    {
+      int fd;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fd = m_notify_fd[0];
+      }
+
+      char buffer[64];
+      while (fd != -1 && ::read(fd, buffer, sizeof(buffer)) > 0);
+    }
+#endif
+
+  protected:
+    // Wakes up consumers, the notifier and descriptor are only passed on an empty to non-empty change
+    void notify(const std::function<void()>& notifier, int notify_fd)
+    {
       {
-        std::unique_lock<std::mutex> lock(m_blocking_mutex);
-        m_blocking_cv.wait(lock);
+        std::unique_lock<std::mutex> blocking_lock(m_blocking_mutex);
+        m_blocking_cv.notify_one();
       }
+
+      if (notifier)
+        notifier();
+
+#if !defined(_WIN32)
+      if (notify_fd != -1)
+        signal_notify_handle(notify_fd);
+#endif
+    }
+
+#if !defined(_WIN32)
+    static void signal_notify_handle(int fd)
+    {
+      const uint64_t value = 1;
+      (void)!::write(fd, &value, sizeof(value));
+    }
+#endif
+
+    void close_notify_handle()
+    {
+#if !defined(_WIN32)
+      if (m_notify_fd[0] != -1)
+        ::close(m_notify_fd[0]);
+      if (m_notify_fd[1] != m_notify_fd[0])
+        ::close(m_notify_fd[1]);
+      m_notify_fd[0] = m_notify_fd[1] = -1;
+#endif
     }
 
   protected:
@@ -102,6 +235,10 @@ namespace netron
 
     std::condition_variable m_blocking_cv;
     std::mutex m_blocking_mutex;
+
+    // Event notification for consumers that do not poll
+    std::function<void()> m_notifier;
+    int m_notify_fd[2] = { -1, -1 };
   };
 
 }
\ No newline at end of file
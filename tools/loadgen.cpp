@@ -0,0 +1,575 @@
+#include <netron.hpp>
+#include <cmath>
+#include <iomanip>
+
+// Load generator and soak test tool.
+//
+// usage: loadgen serve <port> [acceptors]
+//        loadgen run <host> <port> [options]
+//
+// run options:
+//   --connections N        client connections, each one runs its own client_interface (10)
+//   --rate R               requests per second over all connections (1000)
+//   --mode open|fixed      open: requests go out on schedule whether or not earlier ones were answered,
+//                          fixed: every connection waits for the reply before its next request (open)
+//   --arrival fixed|poisson  spacing of the scheduled requests in open mode (fixed)
+//   --size SPEC            request body size: N, uniform:MIN:MAX, exponential:MEAN or
+//                          bimodal:SMALL:LARGE:FRACTION_LARGE (64)
+//   --duration S           seconds to measure (10)
+//   --warmup S             seconds to run before measuring (1)
+//   --interval S           print a progress line every S seconds, 0 disables (1)
+//   --timeout MS           requests without a reply in time count as errors (5000)
+//   --histogram FILE       write the full percentile distribution in HdrHistogram's .hgrm format
+//
+// Requests are made with client_interface::call, so the server has to answer every message with
+// server_interface::reply, as the serve mode does. Latency is measured from the time a request
+// was scheduled to be sent rather than when it was actually sent, so a stalled server or generator
+// shows up in the results instead of silently lowering the request rate (coordinated omission).
+// In fixed mode the schedule can not be kept while waiting for a reply, the samples the stall
+// suppressed are filled in the way HdrHistogram's recordValueWithExpectedInterval does.
+
+enum class LoadMessages : uint32_t
+{
+  Request,
+};
+
+using Message = netron::message<LoadMessages>;
+
+// Log-linear histogram of nanosecond values in the style of HdrHistogram, every power of two range
+// is split into 128 sub-buckets, which keeps the relative error below 1%.
+class histogram
+{
+public:
+  static const int sub_bucket_bits = 8;
+  static const uint64_t sub_bucket_count = uint64_t(1) << sub_bucket_bits;
+  static const uint64_t sub_bucket_half = sub_bucket_count / 2;
+  static const int max_exponent = 40; // a little over an hour in nanoseconds
+
+  histogram()
+    : m_counts(sub_bucket_count + max_exponent * sub_bucket_half, 0)
+  {}
+
+  void record(uint64_t value)
+  {
+    m_counts[index_of(value)]++;
+    m_total++;
+    m_max = std::max(m_max, value);
+    m_sum += double(value);
+  }
+
+  // Also records the samples a closed loop caller would have taken while it waited for this one
+  void record_corrected(uint64_t value, uint64_t expected_interval)
+  {
+    record(value);
+    if (expected_interval == 0)
+      return;
+
+    for (uint64_t missing = value > expected_interval ? value - expected_interval : 0; missing >= expected_interval; missing -= expected_interval)
+      record(missing);
+  }
+
+  void add(const histogram& other)
+  {
+    for (size_t i = 0; i < m_counts.size(); ++i)
+      m_counts[i] += other.m_counts[i];
+    m_total += other.m_total;
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+  }
+
+  void reset()
+  {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_total = 0;
+    m_max = 0;
+    m_sum = 0.0;
+  }
+
+  uint64_t count() const
+  {
+    return m_total;
+  }
+
+  double mean() const
+  {
+    return m_total ? m_sum / m_total : 0.0;
+  }
+
+  uint64_t max() const
+  {
+    return m_max;
+  }
+
+  // Highest value of the bucket holding the given percentile (0..100)
+  uint64_t percentile(double p) const
+  {
+    if (m_total == 0)
+      return 0;
+
+    const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * m_total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); ++i)
+    {
+      seen += m_counts[i];
+      if (seen >= rank)
+        return std::min(m_max, highest_value_of(i));
+    }
+    return m_max;
+  }
+
+  // Percentile distribution as written by HdrHistogram's outputPercentileDistribution
+  void write_hgrm(std::ostream& os, double unit_scale = 1000.0) const
+  {
+    os << std::fixed;
+    os << "       Value     Percentile TotalCount 1/(1-Percentile)\n\n";
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); ++i)
+    {
+      if (m_counts[i] == 0)
+        continue;
+
+      seen += m_counts[i];
+      const double fraction = double(seen) / m_total;
+      os << std::setw(12) << std::setprecision(3) << std::min(m_max, highest_value_of(i)) / unit_scale
+        << std::setw(15) << std::setprecision(12) << fraction
+        << std::setw(11) << seen;
+      if (fraction < 1.0)
+        os << std::setw(15) << std::setprecision(2) << 1.0 / (1.0 - fraction);
+      os << '\n';
+    }
+
+    os << std::setprecision(3);
+    os << "#[Mean    = " << std::setw(12) << mean() / unit_scale << ", Max     = " << std::setw(12) << m_max / unit_scale << "]\n";
+    os << "#[Total count    = " << std::setw(12) << m_total << "]\n";
+  }
+
+private:
+  static size_t index_of(uint64_t value)
+  {
+    if (value < sub_bucket_count)
+      return size_t(value);
+
+    int exponent = 0;
+    while ((value >> exponent) >= sub_bucket_count)
+      exponent++;
+
+    if (exponent > max_exponent)
+      exponent = max_exponent;
+    const uint64_t mantissa = std::min(value >> exponent, sub_bucket_count - 1);
+    return size_t(sub_bucket_count + (exponent - 1) * sub_bucket_half + (mantissa - sub_bucket_half));
+  }
+
+  static uint64_t highest_value_of(size_t index)
+  {
+    if (index < sub_bucket_count)
+      return index;
+
+    const uint64_t exponent = (index - sub_bucket_count) / sub_bucket_half + 1;
+    const uint64_t mantissa = (index - sub_bucket_count) % sub_bucket_half + sub_bucket_half;
+    return ((mantissa + 1) << exponent) - 1;
+  }
+
+private:
+  std::vector<uint64_t> m_counts;
+  uint64_t m_total = 0;
+  uint64_t m_max = 0;
+  double m_sum = 0.0;
+};
+
+// Draws request body sizes
+class size_distribution
+{
+public:
+  // N, uniform:MIN:MAX, exponential:MEAN or bimodal:SMALL:LARGE:FRACTION_LARGE
+  explicit size_distribution(const std::string& spec)
+  {
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string part;
+    while (std::getline(ss, part, ':'))
+      parts.push_back(part);
+
+    if (parts.size() == 1)
+    {
+      m_kind = kind::fixed;
+      m_a = std::stod(parts[0]);
+    }
+    else if (parts.size() == 3 && parts[0] == "uniform")
+    {
+      m_kind = kind::uniform;
+      m_a = std::stod(parts[1]);
+      m_b = std::stod(parts[2]);
+    }
+    else if (parts.size() == 2 && parts[0] == "exponential")
+    {
+      m_kind = kind::exponential;
+      m_a = std::stod(parts[1]);
+    }
+    else if (parts.size() == 4 && parts[0] == "bimodal")
+    {
+      m_kind = kind::bimodal;
+      m_a = std::stod(parts[1]);
+      m_b = std::stod(parts[2]);
+      m_fraction = std::stod(parts[3]);
+    }
+    else
+    {
+      throw std::invalid_argument("Unknown size distribution: " + spec);
+    }
+  }
+
+  uint32_t operator()(std::mt19937_64& random) const
+  {
+    switch (m_kind)
+    {
+    case kind::uniform:
+      return uint32_t(std::uniform_real_distribution<double>(m_a, m_b)(random));
+    case kind::exponential:
+      return uint32_t(std::exponential_distribution<double>(1.0 / std::max(1.0, m_a))(random));
+    case kind::bimodal:
+      return uint32_t(std::bernoulli_distribution(m_fraction)(random) ? m_b : m_a);
+    default:
+      return uint32_t(m_a);
+    }
+  }
+
+private:
+  enum class kind { fixed, uniform, exponential, bimodal };
+
+  kind m_kind = kind::fixed;
+  double m_a = 0.0, m_b = 0.0, m_fraction = 0.0;
+};
+
+struct options
+{
+  std::string host = "127.0.0.1";
+  uint16_t port = 60000;
+  uint32_t connections = 10;
+  double rate = 1000.0;
+  bool is_open_loop = true;
+  bool is_poisson = false;
+  std::string size = "64";
+  double duration = 10.0;
+  double warmup = 1.0;
+  double interval = 1.0;
+  uint32_t timeout = 5000;
+  std::string histogram_file;
+};
+
+// One connection and its request schedule, all of its state is touched on its context thread only
+class load_client : public netron::client_interface<LoadMessages>
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  load_client(const options& o, const size_distribution& sizes, uint64_t seed)
+    : m_options(o), m_sizes(sizes), m_timer(m_asio_context), m_random(seed),
+      m_interval(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(o.connections / o.rate)))
+  {}
+
+  ~load_client()
+  {
+    // The handlers use this object's members, stop them before those go
+    disconnect();
+  }
+
+  // (ASYNC) Start sending at the given time, samples scheduled before measure_from are not recorded
+  void start(clock::time_point first, clock::time_point measure_from, clock::time_point stop_at)
+  {
+    m_measure_from = measure_from;
+    m_stop_at = stop_at;
+    asio::post(m_asio_context, [this, first]() { schedule(first); });
+  }
+
+  // Moves the samples of the interval into the given histograms
+  void collect(histogram& latency, uint64_t& errors, uint64_t& sent)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    latency.add(m_latency);
+    m_latency.reset();
+    errors += m_errors;
+    m_errors = 0;
+    sent += m_sent;
+    m_sent = 0;
+  }
+
+  uint64_t outstanding() const
+  {
+    return m_outstanding;
+  }
+
+private:
+  void schedule(clock::time_point intended)
+  {
+    if (intended >= m_stop_at)
+      return;
+
+    m_timer.expires_at(intended);
+    m_timer.async_wait(
+      [this, intended](std::error_code ec)
+      {
+        if (ec)
+          return;
+
+        send_request(intended);
+
+        // In open mode the next request is due regardless of this one's reply
+        if (m_options.is_open_loop)
+          schedule(intended + next_gap());
+      }
+    );
+  }
+
+  clock::duration next_gap()
+  {
+    if (!m_options.is_poisson)
+      return m_interval;
+
+    std::exponential_distribution<double> gap(1.0);
+    return std::chrono::duration_cast<clock::duration>(m_interval * gap(m_random));
+  }
+
+  void send_request(clock::time_point intended)
+  {
+    Message msg;
+    msg.header.id = LoadMessages::Request;
+    msg.body.resize(m_sizes(m_random));
+    msg.header.size = uint32_t(msg.size());
+
+    m_outstanding++;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_sent++;
+    }
+
+    call(std::move(msg),
+      [this, intended](std::error_code ec, Message& reply)
+      {
+        m_outstanding--;
+        const auto now = clock::now();
+
+        if (intended >= m_measure_from)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (ec)
+          {
+            m_errors++;
+          }
+          else
+          {
+            const uint64_t latency = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now - intended).count());
+            if (m_options.is_open_loop)
+              m_latency.record(latency);
+            else
+              m_latency.record_corrected(latency, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(m_interval).count()));
+          }
+        }
+
+        // In fixed mode the schedule continues once the reply is in, late replies push it back
+        if (!m_options.is_open_loop)
+          schedule(std::max(now, intended + m_interval));
+      },
+      std::chrono::milliseconds(m_options.timeout)
+    );
+  }
+
+private:
+  const options& m_options;
+  const size_distribution& m_sizes;
+  asio::steady_timer m_timer;
+  std::mt19937_64 m_random;
+  clock::duration m_interval;
+  clock::time_point m_measure_from;
+  clock::time_point m_stop_at;
+  std::atomic<uint64_t> m_outstanding{ 0 };
+
+  // Samples of the current interval, guarded for collect()
+  std::mutex m_mutex;
+  histogram m_latency;
+  uint64_t m_errors = 0;
+  uint64_t m_sent = 0;
+};
+
+class echo_server : public netron::server_interface<LoadMessages>
+{
+public:
+  echo_server(uint16_t port, netron::config cfg)
+    : netron::server_interface<LoadMessages>(port, cfg)
+  {}
+
+protected:
+  virtual void on_message(Client client, Message& msg)
+  {
+    reply(client, msg, msg);
+  }
+};
+
+int serve(uint16_t port, uint32_t acceptors)
+{
+  netron::config cfg;
+  cfg.acceptor_count = acceptors;
+
+  netron::logger::set_level(netron::log_level::warning);
+  echo_server server(port, cfg);
+  if (!server.start())
+    return 1;
+
+  asio::io_context dispatch_context;
+  auto work_guard = asio::make_work_guard(dispatch_context);
+  server.dispatch_messages(dispatch_context.get_executor());
+  std::thread dispatch_thread([&dispatch_context]() { dispatch_context.run(); });
+
+  std::cout << "serving on port " << port << " with " << acceptors << " acceptor(s)\n";
+  auto previous = server.metrics();
+  while (true)
+  {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto current = server.metrics();
+    std::cout << "connections " << current.connection_count
+      << "  requests/s " << current.totals.messages_received - previous.totals.messages_received
+      << "  MB/s in " << (current.totals.bytes_received - previous.totals.bytes_received) / 1e6
+      << "  incoming queue " << current.incoming_queue_depth << '\n';
+    previous = current;
+  }
+}
+
+void print_summary(const char* label, const histogram& h, uint64_t errors, double seconds)
+{
+  std::cout << std::fixed << std::setprecision(1) << label
+    << "  requests/s " << h.count() / seconds
+    << "  errors " << errors
+    << "  p50 " << h.percentile(50.0) / 1000.0 << "us"
+    << "  p99 " << h.percentile(99.0) / 1000.0 << "us"
+    << "  p99.9 " << h.percentile(99.9) / 1000.0 << "us"
+    << "  max " << h.max() / 1000.0 << "us\n";
+}
+
+int run(const options& o)
+{
+  netron::logger::set_level(netron::log_level::warning);
+  const size_distribution sizes(o.size);
+
+  netron::config cfg;
+  cfg.call_timeout = o.timeout;
+
+  std::vector<std::unique_ptr<load_client>> clients;
+  for (uint32_t i = 0; i < o.connections; ++i)
+  {
+    clients.emplace_back(new load_client(o, sizes, std::random_device{}()));
+    if (!clients.back()->connect(o.host, o.port, cfg))
+    {
+      std::cerr << "could not connect to " << o.host << ':' << o.port << '\n';
+      return 1;
+    }
+  }
+
+  // Connections start at evenly spread offsets, so the fixed schedule does not send in bursts
+  const auto now = load_client::clock::now();
+  const auto start = now + std::chrono::milliseconds(100);
+  const auto measure_from = start + std::chrono::duration_cast<load_client::clock::duration>(std::chrono::duration<double>(o.warmup));
+  const auto stop_at = measure_from + std::chrono::duration_cast<load_client::clock::duration>(std::chrono::duration<double>(o.duration));
+  const auto spread = std::chrono::duration<double>(o.connections / o.rate) / o.connections;
+  for (uint32_t i = 0; i < o.connections; ++i)
+    clients[i]->start(start + std::chrono::duration_cast<load_client::clock::duration>(spread * i), measure_from, stop_at);
+
+  std::cout << "running " << o.connections << " connections at " << o.rate << " requests/s ("
+    << (o.is_open_loop ? "open" : "fixed") << " mode), warmup " << o.warmup << "s, duration " << o.duration << "s\n";
+
+  histogram total;
+  uint64_t total_errors = 0;
+  auto interval_start = load_client::clock::now();
+  while (load_client::clock::now() < stop_at)
+  {
+    const auto interval = std::chrono::duration<double>(o.interval > 0 ? o.interval : 0.1);
+    std::this_thread::sleep_until(std::min(stop_at, interval_start + std::chrono::duration_cast<load_client::clock::duration>(interval)));
+
+    histogram h;
+    uint64_t errors = 0, sent = 0;
+    for (auto& c : clients)
+      c->collect(h, errors, sent);
+
+    const double elapsed = std::chrono::duration<double>(load_client::clock::now() - interval_start).count();
+    interval_start = load_client::clock::now();
+    if (o.interval > 0 && h.count() + errors > 0)
+      print_summary("interval", h, errors, elapsed);
+
+    total.add(h);
+    total_errors += errors;
+  }
+
+  // Let the requests of the last interval finish
+  const auto drain_deadline = load_client::clock::now() + std::chrono::milliseconds(o.timeout);
+  for (auto& c : clients)
+    while (c->outstanding() > 0 && load_client::clock::now() < drain_deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  {
+    histogram h;
+    uint64_t errors = 0, sent = 0;
+    for (auto& c : clients)
+      c->collect(h, errors, sent);
+    total.add(h);
+    total_errors += errors;
+  }
+
+  print_summary("total   ", total, total_errors, o.duration);
+
+  if (!o.histogram_file.empty())
+  {
+    std::ofstream file(o.histogram_file);
+    total.write_hgrm(file);
+  }
+
+  for (auto& c : clients)
+    c->disconnect();
+  return total_errors == 0 ? 0 : 2;
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<std::string> args(argv + 1, argv + argc);
+  try
+  {
+    if (args.size() >= 2 && args[0] == "serve")
+      return serve(uint16_t(std::stoul(args[1])), args.size() > 2 ? std::stoul(args[2]) : 1);
+
+    if (args.size() >= 3 && args[0] == "run")
+    {
+      options o;
+      o.host = args[1];
+      o.port = uint16_t(std::stoul(args[2]));
+      for (size_t i = 3; i + 1 < args.size(); i += 2)
+      {
+        const std::string& key = args[i];
+        const std::string& value = args[i + 1];
+        if (key == "--connections") o.connections = std::max(1ul, std::stoul(value));
+        else if (key == "--rate") o.rate = std::stod(value);
+        else if (key == "--mode") o.is_open_loop = value != "fixed";
+        else if (key == "--arrival") o.is_poisson = value == "poisson";
+        else if (key == "--size") o.size = value;
+        else if (key == "--duration") o.duration = std::stod(value);
+        else if (key == "--warmup") o.warmup = std::stod(value);
+        else if (key == "--interval") o.interval = std::stod(value);
+        else if (key == "--timeout") o.timeout = std::stoul(value);
+        else if (key == "--histogram") o.histogram_file = value;
+        else throw std::invalid_argument("Unknown option: " + key);
+      }
+
+      if (o.rate <= 0.0)
+        throw std::invalid_argument("--rate must be positive");
+      return run(o);
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+
+  std::cerr << "usage: loadgen serve <port> [acceptors]\n"
+    "       loadgen run <host> <port> [--connections N] [--rate R] [--mode open|fixed] [--arrival fixed|poisson]\n"
+    "                                 [--size SPEC] [--duration S] [--warmup S] [--interval S] [--timeout MS]\n"
+    "                                 [--histogram FILE]\n";
+  return 1;
+}